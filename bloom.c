@@ -0,0 +1,118 @@
+/**
+    @file bloom.c
+    @author
+    Blocked counting Bloom filter.  Every entry maps to one block the size
+    of a cache line, and sets all its counters inside that block.  Counters
+    instead of bits let entries be removed again.
+*/
+
+#include "bloom.h"
+#include <stdlib.h>
+#include <stdint.h>
+
+/** Number of counters in a block, one byte each, filling a cache line. */
+#define BLOCK_LEN 64
+
+/** Number of counters each entry uses within its block. */
+#define PROBES 4
+
+/** Number of counters to allocate per expected entry. */
+#define COUNTERS_PER_ENTRY 8
+
+/** A counter that reaches this value is stuck there, since we no longer
+    know how many entries it stands for. */
+#define SATURATED UINT8_MAX
+
+/** One cache line of counters. */
+typedef struct {
+  uint8_t count[ BLOCK_LEN ];
+} Block;
+
+/** Representation of a blocked counting Bloom filter. */
+struct BloomStruct {
+  /** Blocks of counters. */
+  Block *blocks;
+
+  /** Number of blocks. */
+  unsigned int blen;
+};
+
+/**
+ * Scramble the bits of a hash value.  Map hashes can be poor (Integer
+ * hashes to itself), so this spreads them before picking counters.
+ * @param h Hash to mix.
+ * @return unsigned int the mixed hash.
+ */
+static unsigned int mix( unsigned int h )
+{
+  //the MurmurHash3 finalizer
+  h ^= h >> 16;
+  h *= 0x85EBCA6Bu;
+  h ^= h >> 13;
+  h *= 0xC2B2AE35u;
+  h ^= h >> 16;
+  return h;
+}
+
+/**
+ * Find the block for the given hash and the counters it uses there.
+ * @param b Filter to look in.
+ * @param h Hash of the entry.
+ * @param pos Filled in with the PROBES counter positions in the block.
+ * @return Block* the block for the hash.
+ */
+static Block *locate( Bloom *b, unsigned int h, int *pos )
+{
+  unsigned int blockHash = mix( h );
+  unsigned int counterHash = mix( blockHash ^ h );
+
+  //six bits of the second hash pick each counter in the block
+  for ( int i = 0; i < PROBES; i++ )
+    pos[ i ] = ( counterHash >> ( 6 * i ) ) & ( BLOCK_LEN - 1 );
+
+  return &b->blocks[ blockHash % b->blen ];
+}
+
+Bloom *makeBloom( int capacity )
+{
+  Bloom *b = (Bloom *) malloc( sizeof( Bloom ) );
+  b->blen = ( (long) capacity * COUNTERS_PER_ENTRY + BLOCK_LEN - 1 ) / BLOCK_LEN;
+  if ( b->blen < 1 )
+    b->blen = 1;
+  b->blocks = (Block *) calloc( b->blen, sizeof( Block ) );
+  return b;
+}
+
+void bloomAdd( Bloom *b, unsigned int h )
+{
+  int pos[ PROBES ];
+  Block *block = locate( b, h, pos );
+  for ( int i = 0; i < PROBES; i++ )
+    if ( block->count[ pos[ i ] ] < SATURATED )
+      block->count[ pos[ i ] ]++;
+}
+
+void bloomRemove( Bloom *b, unsigned int h )
+{
+  int pos[ PROBES ];
+  Block *block = locate( b, h, pos );
+  for ( int i = 0; i < PROBES; i++ )
+    if ( block->count[ pos[ i ] ] < SATURATED )
+      block->count[ pos[ i ] ]--;
+}
+
+bool bloomMayContain( Bloom *b, unsigned int h )
+{
+  int pos[ PROBES ];
+  Block *block = locate( b, h, pos );
+  for ( int i = 0; i < PROBES; i++ )
+    if ( block->count[ pos[ i ] ] == 0 )
+      return false;
+  return true;
+}
+
+void freeBloom( Bloom *b )
+{
+  free( b->blocks );
+  free( b );
+}
@@ -0,0 +1,51 @@
+/**
+    @file bloom.h
+    @author
+    Header for the bloom component, a blocked counting Bloom filter over
+    hash values.  A map consults it before walking a list, so most lookups
+    for missing keys cost a single cache line.
+*/
+
+#ifndef BLOOM_H
+#define BLOOM_H
+
+#include <stdbool.h>
+
+/** Incomplete type for the Bloom filter representation. */
+typedef struct BloomStruct Bloom;
+
+/** Make an empty filter sized for the given number of entries.
+    @param capacity Number of entries the filter should expect.
+    @return pointer to a new filter.
+*/
+Bloom *makeBloom( int capacity );
+
+/**
+ * Add an entry with the given hash to the filter.
+ * @param b Pointer to the filter.
+ * @param h Hash of the entry.
+ */
+void bloomAdd( Bloom *b, unsigned int h );
+
+/**
+ * Remove an entry with the given hash from the filter.  The entry must
+ * have been added before.
+ * @param b Pointer to the filter.
+ * @param h Hash of the entry.
+ */
+void bloomRemove( Bloom *b, unsigned int h );
+
+/**
+ * Check whether an entry with the given hash might be in the filter.
+ * @param b Pointer to the filter.
+ * @param h Hash of the entry.
+ * @return false if the entry definitely isn't in the filter.
+ */
+bool bloomMayContain( Bloom *b, unsigned int h );
+
+/** Free all the memory used by a filter.
+    @param b The filter to free.
+*/
+void freeBloom( Bloom *b );
+
+#endif
@@ -0,0 +1,444 @@
+/**
+    @file cuckoo.c
+    @author
+    Bucketized cuckoo hash table.  Each bucket holds the hashes and keys of
+    four entries in one cache line, so a lookup reads at most two bucket
+    lines, plus the stash when anything has overflowed into it.  Values
+    are kept in a parallel array and only read for the key that matches.
+*/
+
+// posix_memalign isn't part of C99.
+#define _DEFAULT_SOURCE
+
+#include "cuckoo.h"
+#include <stdlib.h>
+#include <string.h>
+
+/** Number of entries in a bucket. */
+#define SLOTS 4
+
+/** Size of a cache line, which every bucket fills and is aligned to. */
+#define LINE_SIZE 64
+
+/** Number of entries the stash can hold when neither bucket has room. */
+#define STASH_LEN 4
+
+/** Most buckets a search for room visits before giving up on a key. */
+#define BFS_NODES 256
+
+/** The table grows once this many entries per hundred slots are used. */
+#define MAX_LOAD 90
+
+/** Seed mixed into a hash to pick a key's second bucket. */
+#define ALT_SEED 0x9E3779B9u
+
+/** One cache line of entries.  A null key marks an empty slot. */
+typedef struct {
+  /** Hash of each entry's key. */
+  unsigned int hash[ SLOTS ];
+
+  /** Key of each entry. */
+  VType *key[ SLOTS ];
+
+  /** Unused, to fill out the line. */
+  char pad[ LINE_SIZE - SLOTS * ( sizeof( unsigned int ) + sizeof( VType * ) ) ];
+} Bucket;
+
+/** Representation of a cuckoo table. */
+struct CuckooStruct {
+  /** Buckets of entries, aligned to cache lines. */
+  Bucket *buckets;
+
+  /** Value of each entry, indexed by bucket and then slot. */
+  VType **vals;
+
+  /** Number of buckets, a power of two. */
+  unsigned int blen;
+
+  /** Number of entries, including the ones in the stash. */
+  int size;
+
+  /** Hash of each entry in the stash. */
+  unsigned int stashHash[ STASH_LEN ];
+
+  /** Key of each entry in the stash. */
+  VType *stashKey[ STASH_LEN ];
+
+  /** Value of each entry in the stash. */
+  VType *stashVal[ STASH_LEN ];
+
+  /** Number of entries in the stash, at the front of its arrays. */
+  int stashLen;
+};
+
+/** A bucket reached while searching for room, and how it was reached. */
+typedef struct {
+  /** Index of the bucket. */
+  unsigned int bucket;
+
+  /** Position in the search of the bucket whose entry moves here, or -1
+      if this is one of the new key's own buckets. */
+  int parent;
+
+  /** Slot of the entry in the parent bucket that moves here. */
+  int slot;
+} Step;
+
+/**
+ * Scramble the bits of a hash value.  Map hashes can be poor (Integer
+ * hashes to itself), so this spreads them before picking buckets.
+ * @param h Hash to mix.
+ * @return unsigned int the mixed hash.
+ */
+static unsigned int mix( unsigned int h )
+{
+  //the MurmurHash3 finalizer
+  h ^= h >> 16;
+  h *= 0x85EBCA6Bu;
+  h ^= h >> 13;
+  h *= 0xC2B2AE35u;
+  h ^= h >> 16;
+  return h;
+}
+
+/**
+ * Find the first of the two buckets an entry can live in.
+ * @param c Table to look in.
+ * @param h Hash of the entry.
+ * @return unsigned int index of the bucket.
+ */
+static unsigned int firstBucket( Cuckoo *c, unsigned int h )
+{
+  return mix( h ) & ( c->blen - 1 );
+}
+
+/**
+ * Find the second of the two buckets an entry can live in.
+ * @param c Table to look in.
+ * @param h Hash of the entry.
+ * @return unsigned int index of the bucket, which may be the same as the
+ * first.
+ */
+static unsigned int secondBucket( Cuckoo *c, unsigned int h )
+{
+  return mix( h ^ ALT_SEED ) & ( c->blen - 1 );
+}
+
+/**
+ * Find an empty slot in a bucket.
+ * @param b Bucket to look in.
+ * @return int index of the first empty slot, or -1 if it's full.
+ */
+static int freeSlot( Bucket const *b )
+{
+  for ( int s = 0; s < SLOTS; s++ )
+    if ( !b->key[ s ] )
+      return s;
+  return -1;
+}
+
+/**
+ * Fill in an entry in a bucket.
+ * @param c Table the bucket is in.
+ * @param i Index of the bucket.
+ * @param s Slot in the bucket.
+ * @param h Hash of the key.
+ * @param key Key for the entry.
+ * @param val Value for the entry.
+ * @return VType** the entry's value slot.
+ */
+static VType **place( Cuckoo *c, unsigned int i, int s, unsigned int h,
+                      VType *key, VType *val )
+{
+  c->buckets[ i ].hash[ s ] = h;
+  c->buckets[ i ].key[ s ] = key;
+  c->vals[ i * SLOTS + s ] = val;
+  return &c->vals[ i * SLOTS + s ];
+}
+
+/**
+ * Allocate an empty set of buckets and values.
+ * @param c Table to give them to.
+ * @param blen Number of buckets, a power of two.
+ */
+static void allocBuckets( Cuckoo *c, unsigned int blen )
+{
+  void *p;
+  if ( posix_memalign( &p, LINE_SIZE, blen * sizeof( Bucket ) ) != 0 )
+    abort();
+  memset( p, 0, blen * sizeof( Bucket ) );
+  c->buckets = (Bucket *) p;
+  c->vals = (VType **) malloc( blen * SLOTS * sizeof( VType * ) );
+  c->blen = blen;
+}
+
+/**
+ * Search breadth-first for a chain of moves that frees a slot in one of
+ * a new entry's buckets, and make the moves.  Each move sends an entry to
+ * its other bucket, so every entry stays where lookups expect it.
+ * @param c Table to make room in.
+ * @param h Hash of the new entry.
+ * @param slot Filled in with the freed slot.
+ * @return unsigned int index of the bucket with the freed slot, or
+ * c->blen if there's no chain short enough.
+ */
+static unsigned int makeRoom( Cuckoo *c, unsigned int h, int *slot )
+{
+  Step queue[ BFS_NODES ];
+  int len = 0;
+  queue[ len++ ] = (Step) { firstBucket( c, h ), -1, 0 };
+  queue[ len++ ] = (Step) { secondBucket( c, h ), -1, 0 };
+
+  for ( int q = 0; q < len; q++ ) {
+    Bucket *b = &c->buckets[ queue[ q ].bucket ];
+    for ( int s = 0; s < SLOTS; s++ ) {
+      //each entry here could move to its other bucket
+      unsigned int eh = b->hash[ s ];
+      unsigned int alt = firstBucket( c, eh );
+      if ( alt == queue[ q ].bucket )
+        alt = secondBucket( c, eh );
+      if ( alt == queue[ q ].bucket )
+        continue;
+
+      //a chain that came through alt already would undo its own moves
+      bool onPath = false;
+      for ( int p = q; p >= 0 && !onPath; p = queue[ p ].parent )
+        onPath = queue[ p ].bucket == alt;
+      if ( onPath )
+        continue;
+
+      int empty = freeSlot( &c->buckets[ alt ] );
+      if ( empty < 0 ) {
+        if ( len < BFS_NODES )
+          queue[ len++ ] = (Step) { alt, q, s };
+        continue;
+      }
+
+      //move the entries along the chain, last one first, so each move
+      //goes into the slot the one before it just left
+      unsigned int to = alt;
+      int toSlot = empty;
+      unsigned int from = queue[ q ].bucket;
+      int fromSlot = s;
+      for ( int p = q; ; p = queue[ p ].parent ) {
+        place( c, to, toSlot, c->buckets[ from ].hash[ fromSlot ],
+               c->buckets[ from ].key[ fromSlot ], c->vals[ from * SLOTS + fromSlot ] );
+        to = from;
+        toSlot = fromSlot;
+        if ( queue[ p ].parent < 0 )
+          break;
+        from = queue[ queue[ p ].parent ].bucket;
+        fromSlot = queue[ p ].slot;
+      }
+
+      c->buckets[ to ].key[ toSlot ] = NULL;
+      *slot = toSlot;
+      return to;
+    }
+  }
+
+  return c->blen;
+}
+
+/**
+ * Put an entry in the buckets, or the stash if there's no room in them.
+ * @param c Table to add to.
+ * @param h Hash of the key.
+ * @param key Key for the entry.
+ * @param val Value for the entry.
+ * @return VType** the entry's value slot, or null if there's no room for
+ * it at all.
+ */
+static VType **add( Cuckoo *c, unsigned int h, VType *key, VType *val )
+{
+  unsigned int i = firstBucket( c, h );
+  int s = freeSlot( &c->buckets[ i ] );
+  if ( s < 0 ) {
+    i = secondBucket( c, h );
+    s = freeSlot( &c->buckets[ i ] );
+  }
+  if ( s < 0 )
+    i = makeRoom( c, h, &s );
+  if ( i < c->blen )
+    return place( c, i, s, h, key, val );
+
+  if ( c->stashLen == STASH_LEN )
+    return NULL;
+  s = c->stashLen++;
+  c->stashHash[ s ] = h;
+  c->stashKey[ s ] = key;
+  c->stashVal[ s ] = val;
+  return &c->stashVal[ s ];
+}
+
+/**
+ * Move every entry into a table with the given number of buckets, doubling
+ * it again if the entries don't all fit.
+ * @param c Table to resize.
+ * @param blen New number of buckets, a power of two.
+ */
+static void resize( Cuckoo *c, unsigned int blen )
+{
+  Bucket *oldBuckets = c->buckets;
+  VType **oldVals = c->vals;
+  unsigned int oldLen = c->blen;
+  int oldStashLen = c->stashLen;
+  unsigned int stashHash[ STASH_LEN ];
+  VType *stashKey[ STASH_LEN ];
+  VType *stashVal[ STASH_LEN ];
+  memcpy( stashHash, c->stashHash, sizeof( stashHash ) );
+  memcpy( stashKey, c->stashKey, sizeof( stashKey ) );
+  memcpy( stashVal, c->stashVal, sizeof( stashVal ) );
+
+  for ( bool fits = false; !fits; blen *= 2 ) {
+    allocBuckets( c, blen );
+    c->stashLen = 0;
+    fits = true;
+    for ( unsigned int i = 0; i < oldLen && fits; i++ )
+      for ( int s = 0; s < SLOTS && fits; s++ )
+        if ( oldBuckets[ i ].key[ s ] )
+          fits = add( c, oldBuckets[ i ].hash[ s ], oldBuckets[ i ].key[ s ],
+                      oldVals[ i * SLOTS + s ] ) != NULL;
+    for ( int s = 0; s < oldStashLen && fits; s++ )
+      fits = add( c, stashHash[ s ], stashKey[ s ], stashVal[ s ] ) != NULL;
+    if ( !fits ) {
+      free( c->buckets );
+      free( c->vals );
+    }
+  }
+
+  free( oldBuckets );
+  free( oldVals );
+}
+
+/**
+ * Find the number of buckets a table needs for the given number of
+ * entries.
+ * @param capacity Number of entries.
+ * @return unsigned int number of buckets, a power of two.
+ */
+static unsigned int bucketsFor( int capacity )
+{
+  unsigned int blen = 1;
+  while ( (long) blen * SLOTS * MAX_LOAD / 100 < capacity )
+    blen *= 2;
+  return blen;
+}
+
+Cuckoo *makeCuckoo( int capacity )
+{
+  Cuckoo *c = (Cuckoo *) malloc( sizeof( Cuckoo ) );
+  allocBuckets( c, bucketsFor( capacity ) );
+  c->size = 0;
+  c->stashLen = 0;
+  return c;
+}
+
+void cuckooReserve( Cuckoo *c, int capacity )
+{
+  unsigned int blen = bucketsFor( capacity );
+  if ( blen > c->blen )
+    resize( c, blen );
+}
+
+void cuckooCompact( Cuckoo *c )
+{
+  //resize doubles again if the entries don't fit
+  unsigned int blen = bucketsFor( c->size );
+  if ( blen < c->blen )
+    resize( c, blen );
+}
+
+int cuckooCapacity( Cuckoo *c )
+{
+  return c->blen * SLOTS;
+}
+
+VType **cuckooFind( Cuckoo *c, VType *key, unsigned int h )
+{
+  //check the two buckets, then the stash if anything is in it
+  unsigned int i = firstBucket( c, h );
+  for ( int pass = 0; pass < 2; pass++ ) {
+    Bucket *b = &c->buckets[ i ];
+    for ( int s = 0; s < SLOTS; s++ )
+      if ( b->key[ s ] && b->hash[ s ] == h && key->equals( key, b->key[ s ] ) )
+        return &c->vals[ i * SLOTS + s ];
+    i = secondBucket( c, h );
+  }
+
+  for ( int s = 0; s < c->stashLen; s++ )
+    if ( c->stashHash[ s ] == h && key->equals( key, c->stashKey[ s ] ) )
+      return &c->stashVal[ s ];
+  return NULL;
+}
+
+VType **cuckooInsert( Cuckoo *c, VType *key, unsigned int h )
+{
+  if ( (long) ( c->size + 1 ) * 100 > (long) c->blen * SLOTS * MAX_LOAD )
+    resize( c, c->blen * 2 );
+
+  //when neither the buckets nor the stash have room, grow and try again
+  VType **slot;
+  while ( !( slot = add( c, h, key, NULL ) ) )
+    resize( c, c->blen * 2 );
+  c->size++;
+  return slot;
+}
+
+VType *cuckooRemove( Cuckoo *c, VType *key, unsigned int h, VType **val )
+{
+  VType **slot = cuckooFind( c, key, h );
+  if ( !slot )
+    return NULL;
+  c->size--;
+  *val = *slot;
+
+  //an entry in the stash is replaced by the stash's last one
+  if ( slot >= c->stashVal && slot < c->stashVal + STASH_LEN ) {
+    int s = slot - c->stashVal;
+    VType *found = c->stashKey[ s ];
+    c->stashLen--;
+    c->stashHash[ s ] = c->stashHash[ c->stashLen ];
+    c->stashKey[ s ] = c->stashKey[ c->stashLen ];
+    c->stashVal[ s ] = c->stashVal[ c->stashLen ];
+    return found;
+  }
+
+  int pos = slot - c->vals;
+  Bucket *b = &c->buckets[ pos / SLOTS ];
+  VType *found = b->key[ pos % SLOTS ];
+  b->key[ pos % SLOTS ] = NULL;
+
+  //the freed slot may let an entry leave the stash
+  for ( int s = 0; s < c->stashLen; s++ )
+    if ( firstBucket( c, c->stashHash[ s ] ) == pos / SLOTS ||
+         secondBucket( c, c->stashHash[ s ] ) == pos / SLOTS ) {
+      place( c, pos / SLOTS, pos % SLOTS, c->stashHash[ s ], c->stashKey[ s ],
+             c->stashVal[ s ] );
+      c->stashLen--;
+      c->stashHash[ s ] = c->stashHash[ c->stashLen ];
+      c->stashKey[ s ] = c->stashKey[ c->stashLen ];
+      c->stashVal[ s ] = c->stashVal[ c->stashLen ];
+      break;
+    }
+
+  return found;
+}
+
+void cuckooForEach( Cuckoo *c, void (*visit)( VType *key, VType *val, void *data ),
+                    void *data )
+{
+  for ( unsigned int i = 0; i < c->blen; i++ )
+    for ( int s = 0; s < SLOTS; s++ )
+      if ( c->buckets[ i ].key[ s ] )
+        visit( c->buckets[ i ].key[ s ], c->vals[ i * SLOTS + s ], data );
+  for ( int s = 0; s < c->stashLen; s++ )
+    visit( c->stashKey[ s ], c->stashVal[ s ], data );
+}
+
+void freeCuckoo( Cuckoo *c )
+{
+  free( c->buckets );
+  free( c->vals );
+  free( c );
+}
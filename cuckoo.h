@@ -0,0 +1,93 @@
+/**
+    @file cuckoo.h
+    @author
+    Header for the cuckoo component, a bucketized cuckoo hash table of key
+    / value pairs.  Every key lives in one of two buckets of four slots,
+    or in a small stash, so a lookup checks a fixed number of places no
+    matter how the keys hash.  Inserting moves keys between their two
+    buckets to make room, and grows the table when that fails.
+*/
+
+#ifndef CUCKOO_H
+#define CUCKOO_H
+
+#include <stdbool.h>
+
+#include "vtype.h"
+
+/** Incomplete type for the cuckoo table representation. */
+typedef struct CuckooStruct Cuckoo;
+
+/** Make an empty table with room for the given number of entries.
+    @param capacity Number of entries the table should expect.
+    @return pointer to a new table.
+*/
+Cuckoo *makeCuckoo( int capacity );
+
+/**
+ * Grow a table, if needed, so it has room for the given number of
+ * entries without growing again.
+ * @param c Pointer to the table.
+ * @param capacity Number of entries to make room for.
+ */
+void cuckooReserve( Cuckoo *c, int capacity );
+
+/**
+ * Shrink a table to the fewest buckets that hold its entries.
+ * @param c Pointer to the table.
+ */
+void cuckooCompact( Cuckoo *c );
+
+/**
+ * Get the number of slots in a table's buckets, not counting the stash.
+ * @param c Pointer to the table.
+ * @return int number of slots.
+ */
+int cuckooCapacity( Cuckoo *c );
+
+/**
+ * Find the value slot for a key.
+ * @param c Pointer to the table.
+ * @param key Key to look for.
+ * @param h Hash of the key.
+ * @return VType** the key's value slot, or null if it isn't in the table.
+ */
+VType **cuckooFind( Cuckoo *c, VType *key, unsigned int h );
+
+/**
+ * Add a key that isn't in the table yet.  The table holds on to the key
+ * but doesn't own it.
+ * @param c Pointer to the table.
+ * @param key Key to add.
+ * @param h Hash of the key.
+ * @return VType** the key's value slot, null for the caller to fill in.
+ * It moves the next time the table changes.
+ */
+VType **cuckooInsert( Cuckoo *c, VType *key, unsigned int h );
+
+/**
+ * Take a key out of the table.
+ * @param c Pointer to the table.
+ * @param key Key to remove.
+ * @param h Hash of the key.
+ * @param val Filled in with the key's value, if it was in the table.
+ * @return VType* the table's copy of the key, or null if it wasn't there.
+ */
+VType *cuckooRemove( Cuckoo *c, VType *key, unsigned int h, VType **val );
+
+/**
+ * Call a function on every key / value pair in the table, in no
+ * particular order.  The function must not change the table.
+ * @param c Pointer to the table.
+ * @param visit Function to call on each pair.
+ * @param data Passed through to visit.
+ */
+void cuckooForEach( Cuckoo *c, void (*visit)( VType *key, VType *val, void *data ),
+                    void *data );
+
+/** Free all the memory used by a table, but not its keys and values.
+    @param c The table to free.
+*/
+void freeCuckoo( Cuckoo *c );
+
+#endif
@@ -0,0 +1,123 @@
+// Benchmark for lookup latency, comparing the map's chained table with
+// its cuckoo table.  Every lookup is timed on its own, and the report
+// gives percentiles, since the cuckoo table is about the slowest lookups
+// rather than the average.  Keys are either spread out or all multiples
+// of a large power of two, which crowds the chained table's lists.
+
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "vtype.h"
+#include "map.h"
+#include "integer.h"
+
+/** Default number of keys to put in the map. */
+#define DEFAULT_KEYS ( 1 << 20 )
+
+/** Number of lookups to time. */
+#define LOOKUPS ( 1 << 22 )
+
+/** Spacing of the crowded keys, so they share their low bits. */
+#define CROWD_STRIDE ( 1u << 20 )
+
+/**
+ * Read a monotonic clock.
+ * @return long long the time in nanoseconds.
+ */
+static long long now( void )
+{
+  struct timespec t;
+  clock_gettime( CLOCK_MONOTONIC, &t );
+  return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+/**
+ * Order two latencies, for qsort.
+ * @param a Pointer to the first latency.
+ * @param b Pointer to the second latency.
+ * @return int negative, zero or positive as a is less than, equal to or
+ * greater than b.
+ */
+static int compareTimes( void const *a, void const *b )
+{
+  int x = *(int const *) a;
+  int y = *(int const *) b;
+  return ( x > y ) - ( x < y );
+}
+
+/**
+ * Get the key for a given position, spread out or crowded.
+ * @param i Position of the key.
+ * @param crowded True for keys that share their low bits.
+ * @return int the key.
+ */
+static int keyAt( int i, bool crowded )
+{
+  //both are one-to-one for any number of keys an int can count
+  unsigned int u = i;
+  return crowded ? (int) ( u * CROWD_STRIDE + ( u >> 11 ) ) : (int) ( u * 2654435761u );
+}
+
+/**
+ * Fill a map, time random lookups in it one at a time, and report the
+ * percentiles.
+ * @param cuckoo True to use the cuckoo table.
+ * @param crowded True for keys that share their low bits.
+ * @param keys Number of keys to put in the map.
+ * @param times Space to record LOOKUPS latencies.
+ */
+static void run( bool cuckoo, bool crowded, int keys, int *times )
+{
+  Map *m = makeMap( 1 );
+  if ( cuckoo )
+    mapEnableCuckoo( m );
+  for ( int i = 0; i < keys; i++ )
+    mapSet( m, makeInteger( keyAt( i, crowded ) ), makeInteger( i ) );
+
+  unsigned int seed = 0x9E3779B9u;
+  long check = 0;
+  Integer key;
+  for ( int i = 0; i < LOOKUPS; i++ ) {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    initInteger( &key, keyAt( seed % keys, crowded ) );
+    long long start = now();
+    check += ( (Integer *) mapGet( m, (VType *) &key ) )->val;
+    times[ i ] = now() - start;
+  }
+  freeMap( m );
+  if ( check < 0 )
+    printf( "unexpected check %ld\n", check );
+
+  qsort( times, LOOKUPS, sizeof( int ), compareTimes );
+  printf( "%-8s %-8s %8d %8d %8d %8d %8d\n", cuckoo ? "cuckoo" : "chained",
+          crowded ? "crowded" : "spread", times[ LOOKUPS / 2 ],
+          times[ (int) ( LOOKUPS * 0.99 ) ], times[ (int) ( LOOKUPS * 0.999 ) ],
+          times[ (int) ( LOOKUPS * 0.9999 ) ], times[ LOOKUPS - 1 ] );
+  fflush( stdout );
+}
+
+int main( int argc, char *argv[] )
+{
+  int keys = argc > 1 ? atoi( argv[ 1 ] ) : DEFAULT_KEYS;
+  if ( keys <= 0 ) {
+    fprintf( stderr, "usage: cuckooBench [keys]\n" );
+    return EXIT_FAILURE;
+  }
+
+  int *times = (int *) malloc( LOOKUPS * sizeof( int ) );
+  printf( "%d keys, %d lookups, latency in ns including the clock reads\n",
+          keys, LOOKUPS );
+  printf( "%-8s %-8s %8s %8s %8s %8s %8s\n", "table", "keys", "p50", "p99",
+          "p999", "p9999", "max" );
+  for ( int crowded = 0; crowded < 2; crowded++ )
+    for ( int cuckoo = 0; cuckoo < 2; cuckoo++ )
+      run( cuckoo, crowded, keys, times );
+
+  free( times );
+  return EXIT_SUCCESS;
+}
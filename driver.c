@@ -4,21 +4,40 @@
     Main program for the hash map program.
 */
 
+// fork and wait aren't part of C99.
+#define _DEFAULT_SOURCE
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdbool.h>
 #include <ctype.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/wait.h>
 
 #include "map.h"
 #include "vtype.h"
 #include "integer.h"
 #include "text.h"
 #include "input.h"
+#include "replay.h"
 
 /** Maximum length for a command name. */
 #define MAX_CMD 10
 
+/** Initial capacity for the list of values in a multi-key command. */
+#define INITIAL_GROUP_CAPACITY 8
+
+/** Initial hash table length when none is given on the command line. */
+#define DEFAULT_TABLE_LEN 100
+
+/** Number of worker processes in replay mode when none is given. */
+#define DEFAULT_WORKERS 4
+
+/** Added to a command log's name to get the name of its output file. */
+#define REPLAY_SUFFIX ".out"
+
 /** 
     Front-end for the Integer and Text parsing functions.  This tries
     to make an integer from the given string, and, failing that, tries
@@ -58,107 +77,416 @@ static bool blankString( char *str )
 }
 
 /**
-   Starting point for the program.
-   @return exit status for the program.
+    Parse every value in the rest of a command, for the multi-key
+    commands.  If any of them doesn't parse, the ones that did are freed.
+    @param pos Rest of the command, after the command name.
+    @param count Filled in with the number of values parsed.
+    @return dynamically allocated list of values, or NULL if the rest of
+    the command isn't a list of values.
+*/
+static VType **parseGroup( char const *pos, int *count )
+{
+  int capacity = INITIAL_GROUP_CAPACITY;
+  VType **group = (VType **) malloc( capacity * sizeof( VType * ) );
+  *count = 0;
+
+  // Keep parsing values until there's nothing but whitespace left.
+  int n;
+  while ( !blankString( (char *) pos ) ) {
+    VType *v = parseVType( pos, &n );
+    if ( !v ) {
+      for ( int i = 0; i < *count; i++ )
+        group[ i ]->destroy( group[ i ] );
+      free( group );
+      return NULL;
+    }
+    pos += n;
+
+    if ( *count == capacity ) {
+      capacity *= 2;
+      group = (VType **) realloc( group, capacity * sizeof( VType * ) );
+    }
+    group[ ( *count )++ ] = v;
+  }
+
+  return group;
+}
+
+/** Print one key/value pair reported by a range query, on its own line.
+    @param key Key of the pair.
+    @param val Value associated with the key.
+    @param data Unused.
+*/
+static void printPair( VType const *key, VType *val, void *data )
+{
+  key->print( key );
+  printf( " " );
+  val->print( val );
+  printf( "\n" );
+}
+
+/**
+   Echo one command, apply it to the map and report its result.
+   @param map Map the command works on.
+   @param line The command, without its linefeed.
+   @return false if the command was quit, true otherwise.
  */
-int main()
+static bool runCommand( Map *map, char *line )
 {
-  // Make our map, with a 100-element table.
-  Map *map = makeMap( 100 );
+  // Echo the command back to the user.
+  printf( "%s\n", line );
+
+  // Extract the first word from the command.
+  bool valid = false;
+  char cmd[ MAX_CMD + 1 ];
+  int n;
+  if ( sscanf( line, "%10s%n", cmd, &n ) == 1 ) {
+    // Pos keeps up with where we are in parsing the command.
+    char *pos = line + n;
+    if ( strcmp( cmd, "get" ) == 0 ) {
+      // Parse the key from the command.
+      VType *k = parseVType( pos, &n );
+      if ( k ) {
+        pos += n;
+
+        // Make sure we got a key and there's nothing extra in the command.
+        if ( blankString( pos ) ) {
+          valid = true;
+          VType *v = mapGet( map, k );
+          // Report the value for this key, or undefined.
+          if ( v ) {
+            v->print( v );
+            printf( "\n" );
+          } else
+            printf( "Undefined\n" );
+        }
+
+        // Free the key we parsed from the input.
+        k->destroy( k );
+      }
+    } else if ( strcmp( cmd, "set" ) == 0 ) {
+      // Parse the key from the command.
+      VType *k = parseVType( pos, &n );
+      if ( k ) {
+        pos += n;
 
-  // Keep reading input from the user.
-  char *line;
-  printf( "cmd> " );
-  while ( ( line = readLine( stdin ) ) ) {
-    // Echo the command back to the user.
-    printf( "%s\n", line );
-
-    // Extract the first word from the command.
-    bool valid = false;
-    char cmd[ MAX_CMD + 1 ];
-    int n;
-    if ( sscanf( line, "%10s%n", cmd, &n ) == 1 ) {
-      // Pos keeps up with where we are in parsing the command.
-      char *pos = line + n;
-      if ( strcmp( cmd, "get" ) == 0 ) {
         // Parse the key from the command.
-        VType *k = parseVType( pos, &n );
-        if ( k ) {
+        VType *v = parseVType( pos, &n );
+        if( v ) {
           pos += n;
 
-          // Make sure we got a key and there's nothing extra in the command.
-          if ( blankString( pos ) ) {
+          //Make sure we got a key and value and there's nothing extra in the command.
+          if( blankString( pos ) ) {
             valid = true;
-            VType *v = mapGet( map, k );
-            // Report the value for this key, or undefined.
-            if ( v ) {
-              v->print( v );
-              printf( "\n" );
-            } else
-              printf( "Undefined\n" );
+            mapSet( map, k, v );
           }
-
-          // Free the key we parsed from the input.
-          k->destroy( k );
+          
         }
-      } else if ( strcmp( cmd, "set" ) == 0 ) {
-        // Parse the key from the command.
-        VType *k = parseVType( pos, &n );
-        if ( k ) {
-          pos += n;
+      }
+
 
-          // Parse the key from the command.
-          VType *v = parseVType( pos, &n );
-          if( v ) {
-            pos += n;
+    } else if ( strcmp( cmd, "incr" ) == 0 ) {
+      // Parse the key from the command.
+      VType *k = parseVType( pos, &n );
+      if ( k ) {
+        pos += n;
 
-            //Make sure we got a key and value and there's nothing extra in the command.
-            if( blankString( pos ) ) {
-              valid = true;
-              mapSet( map, k, v );
+        // Parse the amount to add, and make sure there's nothing extra.
+        int delta;
+        if ( sscanf( pos, "%d%n", &delta, &n ) == 1 && blankString( pos + n ) ) {
+          // Find the key's value slot, adding the key if it's new.
+          bool inserted;
+          VType **slot = mapEntry( map, k, &inserted );
+          if ( inserted ) {
+            // A new key starts out at the amount added.
+            valid = true;
+            *slot = makeInteger( delta );
+          } else {
+            // The map already has this key, so free the one we parsed.
+            k->destroy( k );
+
+            // Only an Integer value can be incremented, and it's done in
+            // place, as long as the sum still fits in an int.
+            if ( isInteger( *slot ) ) {
+              int val = ( (Integer *) *slot )->val;
+              if ( delta > 0 ? val <= INT_MAX - delta : val >= INT_MIN - delta ) {
+                valid = true;
+                ( (Integer *) *slot )->val = val + delta;
+              }
             }
-            
           }
-        }
 
+          // Report the new value.
+          if ( valid ) {
+            (*slot)->print( *slot );
+            printf( "\n" );
+          }
+        } else
+          k->destroy( k );
+      }
+    } else if ( strcmp( cmd, "remove" ) == 0 ) {
+      // Parse the key from the command.
+      VType *k = parseVType( pos, &n );
+      if( k ) {
+        pos += n;
 
-      } else if ( strcmp( cmd, "remove" ) == 0 ) {
-        // Parse the key from the command.
-        VType *k = parseVType( pos, &n );
-        if( k ) {
-          pos += n;
+        // Make sure we got a key and there's nothing extra in the command.
+        if ( blankString( pos ) ) {
+          valid = true;
+          bool removed = mapRemove( map, k );
+          // if a value was not removed, report that its not in the map
+          if ( !removed ) {
+            printf( "Not in map\n" );
+          } 
+        }
 
-          // Make sure we got a key and there's nothing extra in the command.
-          if ( blankString( pos ) ) {
-            valid = true;
-            bool removed = mapRemove( map, k );
-            // if a value was not removed, report that its not in the map
-            if ( !removed ) {
-              printf( "Not in map\n" );
-            } 
+        //Free the key we parsed from input
+        k->destroy( k );
+      }
+    } else if ( strcmp( cmd, "mget" ) == 0 ) {
+      // Parse all the keys before touching the map.
+      int count;
+      VType **keys = parseGroup( pos, &count );
+      if ( keys ) {
+        if ( count > 0 ) {
+          // Look them all up, then report each value, or undefined.
+          valid = true;
+          VType **vals = (VType **) malloc( count * sizeof( VType * ) );
+          mapGetAll( map, keys, count, vals );
+          for ( int i = 0; i < count; i++ ) {
+            if ( vals[ i ] ) {
+              vals[ i ]->print( vals[ i ] );
+              printf( "\n" );
+            } else
+              printf( "Undefined\n" );
           }
+          free( vals );
+        }
 
-          //Free the key we parsed from input
-          k->destroy( k );
+        // Free the keys we parsed from the input.
+        for ( int i = 0; i < count; i++ )
+          keys[ i ]->destroy( keys[ i ] );
+        free( keys );
+      }
+    } else if ( strcmp( cmd, "mset" ) == 0 ) {
+      // Parse all the keys and values before touching the map.
+      int count;
+      VType **pairs = parseGroup( pos, &count );
+      if ( pairs ) {
+        if ( count > 0 && count % 2 == 0 ) {
+          // Split the list into keys and values and set them as a group.
+          valid = true;
+          int n = count / 2;
+          VType **keys = (VType **) malloc( n * sizeof( VType * ) );
+          VType **vals = (VType **) malloc( n * sizeof( VType * ) );
+          for ( int i = 0; i < n; i++ ) {
+            keys[ i ] = pairs[ 2 * i ];
+            vals[ i ] = pairs[ 2 * i + 1 ];
+          }
+          mapSetAll( map, keys, vals, n );
+          free( keys );
+          free( vals );
+        } else {
+          // The map didn't take them, so free what we parsed.
+          for ( int i = 0; i < count; i++ )
+            pairs[ i ]->destroy( pairs[ i ] );
         }
-      } else if ( strcmp( cmd, "size" ) == 0 ) {
-        // Any extra input after the command?
+        free( pairs );
+      }
+    } else if ( strcmp( cmd, "mdel" ) == 0 ) {
+      // Parse all the keys before touching the map.
+      int count;
+      VType **keys = parseGroup( pos, &count );
+      if ( keys ) {
+        if ( count > 0 ) {
+          // Remove them all and report how many were in the map.
+          valid = true;
+          printf( "%d\n", mapRemoveAll( map, keys, count ) );
+        }
+
+        // Free the keys we parsed from the input.
+        for ( int i = 0; i < count; i++ )
+          keys[ i ]->destroy( keys[ i ] );
+        free( keys );
+      }
+    } else if ( strcmp( cmd, "range" ) == 0 ) {
+      // Parse the two bounds of the range.
+      int lo, hi;
+      if ( sscanf( pos, "%d%d%n", &lo, &hi, &n ) == 2 ) {
+        pos += n;
+
+        // Make sure there's nothing extra in the command.
         if ( blankString( pos ) ) {
-          // Report the size of the map.
+          // Report every pair with an Integer key in the range, in order.
           valid = true;
-          printf( "%d\n", mapSize( map ) );
+          mapRange( map, lo, hi, printPair, NULL );
         }
-      } else if ( strcmp( cmd, "quit" ) == 0 ) {
-        // Free the current command and the map before exitign.
-        free( line );
-        freeMap( map );
-        exit( EXIT_SUCCESS );
       }
+    } else if ( strcmp( cmd, "compact" ) == 0 ) {
+      // Any extra input after the command?
+      if ( blankString( pos ) ) {
+        // Give back table memory left over from removed keys.
+        valid = true;
+        mapCompact( map );
+      }
+    } else if ( strcmp( cmd, "size" ) == 0 ) {
+      // Any extra input after the command?
+      if ( blankString( pos ) ) {
+        // Report the size of the map.
+        valid = true;
+        printf( "%d\n", mapSize( map ) );
+      }
+    } else if ( strcmp( cmd, "quit" ) == 0 ) {
+      // Let the caller free the command and the map.
+      return false;
     }
+  }
+
+  // Print a message if we didn't get a valid command.
+  if ( ! valid )
+    printf( "Invalid command\n" );
+  return true;
+}
+
+/**
+   Replay one command log into a map of its own, with output going to the
+   log's name with .out added.
+   @param path Name of the command log.
+   @param tableLen Initial table length for the map.
+   @return true if the whole log was read and its output written.
+ */
+static bool replayFile( char const *path, int tableLen )
+{
+  Replay *r = openReplay( path );
+  if ( !r ) {
+    fprintf( stderr, "Can't open file: %s\n", path );
+    return false;
+  }
 
-    // Print a message if we didn't get a valid command.
-    if ( ! valid )
-      printf( "Invalid command\n" );
+  // Send this log's output to its own file, so it stays in order.
+  char *out = (char *) malloc( strlen( path ) + sizeof( REPLAY_SUFFIX ) );
+  strcpy( out, path );
+  strcat( out, REPLAY_SUFFIX );
+  if ( !freopen( out, "w", stdout ) ) {
+    fprintf( stderr, "Can't open file: %s\n", out );
+    free( out );
+    closeReplay( r );
+    return false;
+  }
+  free( out );
+
+  // Same output as the interactive loop, prompts and all.
+  Map *map = makeMap( tableLen );
+  char *line;
+  bool running = true;
+  printf( "cmd> " );
+  while ( running && ( line = replayLine( r ) ) ) {
+    running = runCommand( map, line );
+    free( line );
+    if ( running )
+      printf( "\ncmd> " );
+  }
+  freeMap( map );
+
+  bool ok = closeReplay( r );
+  if ( !ok )
+    fprintf( stderr, "Can't read file: %s\n", path );
+  return fclose( stdout ) == 0 && ok;
+}
+
+/**
+   Replay a list of command logs with a pool of worker processes, each
+   working on one log at a time.  Each worker's map and output are its
+   own, so nothing is shared but the disk.
+   @param paths Names of the command logs.
+   @param count Number of logs.
+   @param workers Most workers to run at once.
+   @param tableLen Initial table length for each map.
+   @return true if every log was replayed.
+ */
+static bool replayAll( char *paths[], int count, int workers, int tableLen )
+{
+  // Anything buffered would be written again by every worker.
+  fflush( stdout );
+
+  bool ok = true;
+  int running = 0;
+  for ( int i = 0; i < count || running > 0; ) {
+    // Start another worker if there's a log left and room in the pool.
+    if ( i < count && running < workers ) {
+      pid_t pid = fork();
+      if ( pid == 0 )
+        _exit( replayFile( paths[ i ], tableLen ) ? EXIT_SUCCESS : EXIT_FAILURE );
+      if ( pid < 0 ) {
+        fprintf( stderr, "Can't start a worker for: %s\n", paths[ i ] );
+        ok = false;
+      } else
+        running++;
+      i++;
+      continue;
+    }
+
+    // Otherwise, wait for a worker to finish.
+    int status;
+    if ( wait( &status ) < 0 )
+      break;
+    running--;
+    if ( !WIFEXITED( status ) || WEXITSTATUS( status ) != EXIT_SUCCESS )
+      ok = false;
+  }
+  return ok;
+}
+
+/**
+   Starting point for the program.
+   @param argc Number of command-line arguments.
+   @param argv Command-line arguments, optionally the initial table length,
+   or -r, an optional worker count and the command logs to replay.
+   @return exit status for the program.
+ */
+int main( int argc, char *argv[] )
+{
+  // Replay mode reads its commands from files rather than the user.
+  if ( argc > 1 && strcmp( argv[ 1 ], "-r" ) == 0 ) {
+    int workers = DEFAULT_WORKERS;
+    int first = 2;
+    if ( argc > 3 && strcmp( argv[ 2 ], "-j" ) == 0 ) {
+      if ( sscanf( argv[ 3 ], "%d", &workers ) != 1 || workers < 1 )
+        first = argc;
+      else
+        first = 4;
+    }
+    if ( first >= argc ) {
+      fprintf( stderr, "usage: driver [table-length]\n"
+               "       driver -r [-j workers] file...\n" );
+      exit( EXIT_FAILURE );
+    }
+    return replayAll( argv + first, argc - first, workers, DEFAULT_TABLE_LEN ) ?
+      EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  // Use the initial table length from the command line, if there is one.
+  int tableLen = DEFAULT_TABLE_LEN;
+  if ( argc > 2 || ( argc == 2 && ( sscanf( argv[ 1 ], "%d", &tableLen ) != 1 ||
+                                    tableLen < 1 ) ) ) {
+    fprintf( stderr, "usage: driver [table-length]\n"
+             "       driver -r [-j workers] file...\n" );
+    exit( EXIT_FAILURE );
+  }
+
+  // Make our map, pre-sized to the requested table length.
+  Map *map = makeMap( tableLen );
+
+  // Keep reading input from the user.
+  char *line;
+  printf( "cmd> " );
+  while ( ( line = readLine( stdin ) ) ) {
+    if ( !runCommand( map, line ) ) {
+      // Free the current command and the map before exiting.
+      free( line );
+      freeMap( map );
+      exit( EXIT_SUCCESS );
+    }
 
     // Free the last command and prompt for another one.
     free( line );
@@ -0,0 +1,531 @@
+/**
+    @file frozen.c
+    @author
+    Read-only map images built around a minimal perfect hash, in the
+    style of CHD.  Keys are hashed once to 64 bits.  The high half picks
+    a bucket of about BUCKET_LOAD keys, and each bucket stores a seed,
+    found when the image is built, that sends its keys to free slots.
+    A lookup rehashes with its bucket's seed to find its one slot.
+
+    The image is a header, the bucket seeds, the slots, then the records
+    for every key and value, each key next to its value in slot order.
+*/
+
+// mmap and fstat aren't part of C99.
+#define _DEFAULT_SOURCE
+
+#include "frozen.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/** Identifies an image file, and its layout version. */
+#define FROZEN_MAGIC "VMAPFRZ1"
+
+/** Average number of keys per bucket. */
+#define BUCKET_LOAD 4
+
+/** Largest number of seeds to try for one bucket before giving up. */
+#define MAX_SEED_TRIES ( 1u << 26 )
+
+/** Kinds of value stored in an image. */
+enum { FROZEN_INTEGER, FROZEN_TEXT };
+
+/** Fixed header at the start of an image. */
+typedef struct {
+  /** FROZEN_MAGIC, without its null terminator. */
+  char magic[ 8 ];
+
+  /** Number of key/value pairs, and slots. */
+  uint32_t count;
+
+  /** Number of buckets, and seeds. */
+  uint32_t buckets;
+
+  /** Offset of the seeds, the slots and the records in the image. */
+  uint64_t seedsOff, slotsOff, dataOff;
+
+  /** Size of the whole image. */
+  uint64_t size;
+} FrozenHeader;
+
+/** Slot for one key/value pair. */
+typedef struct {
+  /** Full hash of the key, so most misses are rejected right here. */
+  uint64_t hash;
+
+  /** Offset of the key's record in the image. */
+  uint32_t keyOff;
+
+  /** Offset of the value's record in the image. */
+  uint32_t valOff;
+} FrozenSlot;
+
+/** Record for a key or a value, padded to a multiple of four bytes. */
+typedef struct {
+  /** FROZEN_INTEGER or FROZEN_TEXT. */
+  uint32_t kind;
+
+  /** Number of bytes of data, not counting a Text's null terminator. */
+  uint32_t len;
+
+  /** The int, or the string followed by a null terminator. */
+  char data[];
+} FrozenRecord;
+
+/** Representation of an open frozen map. */
+struct FrozenMapStruct {
+  /** Start of the mapped image. */
+  char const *image;
+
+  /** Size of the image. */
+  size_t size;
+
+  /** Number of key/value pairs. */
+  uint32_t count;
+
+  /** Number of buckets. */
+  uint32_t buckets;
+
+  /** Seed for each bucket. */
+  uint32_t const *seeds;
+
+  /** Slot for each key/value pair. */
+  FrozenSlot const *slots;
+};
+
+/** Key or value gathered for freezing, with its encoding. */
+typedef struct {
+  /** FROZEN_INTEGER or FROZEN_TEXT. */
+  uint32_t kind;
+
+  /** Bytes to store. */
+  char const *bytes;
+
+  /** Number of bytes. */
+  uint32_t len;
+
+  /** Copy of an Integer's value, which bytes points to, since a dense
+      map's keys don't outlast the visit that reports them. */
+  int number;
+
+  /** Decoded copy of a Text's string that bytes points to, or null. */
+  char *copy;
+} Encoded;
+
+/** Pair gathered from the map being frozen. */
+typedef struct {
+  /** The key. */
+  Encoded key;
+
+  /** The value. */
+  Encoded val;
+
+  /** Hash of the key. */
+  uint64_t hash;
+} FreezePair;
+
+/** State for gathering the pairs of a map. */
+typedef struct {
+  /** Pairs gathered so far. */
+  FreezePair *pairs;
+
+  /** Number of pairs gathered. */
+  int count;
+
+  /** Set to false if a key or value can't be frozen. */
+  bool ok;
+} Gather;
+
+/**
+ * Find the bytes that represent a key or value in an image.
+ * @param v Value to encode.
+ * @param e Filled in with its encoding.  Free its copy when done with it.
+ * @return bool true if v is an Integer or Text.
+ */
+static bool encode( VType const *v, Encoded *e )
+{
+  e->copy = NULL;
+  if ( isInteger( v ) ) {
+    e->kind = FROZEN_INTEGER;
+    e->number = ( (Integer const *) v )->val;
+    e->bytes = (char const *) &e->number;
+    e->len = sizeof( int );
+    return true;
+  }
+  if ( isText( v ) ) {
+    e->kind = FROZEN_TEXT;
+    e->bytes = textString( v, &e->copy );
+    e->len = strlen( e->bytes );
+    return true;
+  }
+  return false;
+}
+
+/**
+ * Murmur3's 64-bit finalizer, so every bit of the input affects every
+ * bit of the output.
+ * @param h Value to mix.
+ * @return uint64_t the mixed value.
+ */
+static uint64_t fmix64( uint64_t h )
+{
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdull;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ull;
+  h ^= h >> 33;
+  return h;
+}
+
+/**
+ * Hash an encoded key.  Images don't use the VType hash methods, since
+ * a Text's hash depends on the hash function selected when it was parsed.
+ * @param e Key to hash.
+ * @return uint64_t the key's hash.
+ */
+static uint64_t hashEncoded( Encoded const *e )
+{
+  //FNV-1a over the kind and the bytes, then mixed
+  uint64_t h = 0xcbf29ce484222325ull ^ e->kind;
+  for ( uint32_t i = 0; i < e->len; i++ ) {
+    h ^= (unsigned char) e->bytes[ i ];
+    h *= 0x100000001b3ull;
+  }
+  return fmix64( h ^ e->len );
+}
+
+/**
+ * Pick the bucket for a key.
+ * @param h Hash of the key.
+ * @param buckets Number of buckets.
+ * @return uint32_t index of the key's bucket.
+ */
+static uint32_t bucketOf( uint64_t h, uint32_t buckets )
+{
+  return ( h >> 32 ) % buckets;
+}
+
+/**
+ * Pick the slot for a key, given its bucket's seed.
+ * @param h Hash of the key.
+ * @param seed Seed of the key's bucket.
+ * @param count Number of slots.
+ * @return uint32_t index of the key's slot.
+ */
+static uint32_t slotOf( uint64_t h, uint32_t seed, uint32_t count )
+{
+  return fmix64( h ^ ( seed * 0x9E3779B97F4A7C15ull ) ) % count;
+}
+
+/**
+ * Collect one pair of the map being frozen.
+ * @param key Key of the pair.
+ * @param val Value of the pair.
+ * @param data The Gather state.
+ */
+static void gatherPair( VType const *key, VType *val, void *data )
+{
+  Gather *g = (Gather *) data;
+  FreezePair *p = &g->pairs[ g->count ];
+  if ( !encode( key, &p->key ) || !encode( val, &p->val ) ) {
+    free( p->key.copy );
+    g->ok = false;
+    return;
+  }
+  p->hash = hashEncoded( &p->key );
+  g->count++;
+}
+
+/** Buckets and their sizes, for sorting the largest first. */
+static uint32_t *sortSizes;
+
+/**
+ * Order buckets from largest to smallest, then by index.
+ * @param a Pointer to the first bucket index.
+ * @param b Pointer to the second bucket index.
+ * @return int negative if a goes first.
+ */
+static int compareBuckets( void const *a, void const *b )
+{
+  uint32_t x = *(uint32_t const *) a;
+  uint32_t y = *(uint32_t const *) b;
+  if ( sortSizes[ x ] != sortSizes[ y ] )
+    return sortSizes[ x ] > sortSizes[ y ] ? -1 : 1;
+  return x < y ? -1 : x > y;
+}
+
+/**
+ * Find a seed for every bucket that sends each key to a different slot.
+ * Big buckets go first, while most slots are still free.
+ * @param pairs Pairs to place.
+ * @param count Number of pairs, and slots.
+ * @param buckets Number of buckets.
+ * @param seeds Filled in with each bucket's seed.
+ * @param order Filled in with the pair in each slot.
+ * @return bool true if every bucket got a seed.
+ */
+static bool placePairs( FreezePair const *pairs, uint32_t count, uint32_t buckets,
+                        uint32_t *seeds, uint32_t *order )
+{
+  //group the pairs by bucket, with a counting sort
+  uint32_t *sizes = (uint32_t *) calloc( buckets, sizeof( uint32_t ) );
+  uint32_t *start = (uint32_t *) malloc( ( buckets + 1 ) * sizeof( uint32_t ) );
+  uint32_t *members = (uint32_t *) malloc( count * sizeof( uint32_t ) );
+  for ( uint32_t i = 0; i < count; i++ )
+    sizes[ bucketOf( pairs[ i ].hash, buckets ) ]++;
+  start[ 0 ] = 0;
+  for ( uint32_t b = 0; b < buckets; b++ )
+    start[ b + 1 ] = start[ b ] + sizes[ b ];
+  uint32_t *fill = (uint32_t *) malloc( buckets * sizeof( uint32_t ) );
+  memcpy( fill, start, buckets * sizeof( uint32_t ) );
+  for ( uint32_t i = 0; i < count; i++ )
+    members[ fill[ bucketOf( pairs[ i ].hash, buckets ) ]++ ] = i;
+  free( fill );
+
+  uint32_t *byBucket = (uint32_t *) malloc( buckets * sizeof( uint32_t ) );
+  for ( uint32_t b = 0; b < buckets; b++ )
+    byBucket[ b ] = b;
+  sortSizes = sizes;
+  qsort( byBucket, buckets, sizeof( uint32_t ), compareBuckets );
+
+  //try seeds for each bucket until all of its keys land in free slots
+  bool *taken = (bool *) calloc( count, sizeof( bool ) );
+  uint32_t *tried = (uint32_t *) malloc( ( count > 0 ? count : 1 ) * sizeof( uint32_t ) );
+  bool ok = true;
+  for ( uint32_t k = 0; ok && k < buckets; k++ ) {
+    uint32_t b = byBucket[ k ];
+    seeds[ b ] = 0;
+    if ( sizes[ b ] == 0 )
+      continue;
+
+    uint32_t seed;
+    for ( seed = 0; seed < MAX_SEED_TRIES; seed++ ) {
+      uint32_t placed = 0;
+      for ( ; placed < sizes[ b ]; placed++ ) {
+        uint32_t s = slotOf( pairs[ members[ start[ b ] + placed ] ].hash, seed, count );
+        if ( taken[ s ] )
+          break;
+        taken[ s ] = true;
+        tried[ placed ] = s;
+      }
+      if ( placed == sizes[ b ] )
+        break;
+
+      //undo the partial placement before trying the next seed
+      for ( uint32_t j = 0; j < placed; j++ )
+        taken[ tried[ j ] ] = false;
+    }
+
+    if ( seed == MAX_SEED_TRIES )
+      ok = false;
+    else {
+      seeds[ b ] = seed;
+      for ( uint32_t j = 0; j < sizes[ b ]; j++ )
+        order[ tried[ j ] ] = members[ start[ b ] + j ];
+    }
+  }
+
+  free( tried );
+  free( taken );
+  free( byBucket );
+  free( members );
+  free( start );
+  free( sizes );
+  return ok;
+}
+
+/**
+ * Size of the record for an encoded key or value.
+ * @param e Key or value.
+ * @return size_t number of bytes, a multiple of four.
+ */
+static size_t recordSize( Encoded const *e )
+{
+  size_t bytes = sizeof( FrozenRecord ) + e->len + ( e->kind == FROZEN_TEXT );
+  return ( bytes + 3 ) & ~(size_t) 3;
+}
+
+/**
+ * Write the record for an encoded key or value.
+ * @param e Key or value.
+ * @param dest Where to write it, with recordSize bytes of room.
+ */
+static void writeRecord( Encoded const *e, char *dest )
+{
+  FrozenRecord *r = (FrozenRecord *) dest;
+  memset( r, 0, recordSize( e ) );
+  r->kind = e->kind;
+  r->len = e->len;
+  memcpy( r->data, e->bytes, e->len );
+}
+
+bool mapFreeze( Map *m, char const *path )
+{
+  //gather every pair in place, so a dense or cuckoo map keeps its mode
+  Gather g = { (FreezePair *) malloc( ( mapSize( m ) + 1 ) * sizeof( FreezePair ) ), 0, true };
+  mapForEach( m, gatherPair, &g );
+
+  FrozenHeader h;
+  memcpy( h.magic, FROZEN_MAGIC, sizeof( h.magic ) );
+  h.count = g.count;
+  h.buckets = g.count / BUCKET_LOAD + 1;
+
+  uint32_t *seeds = (uint32_t *) malloc( h.buckets * sizeof( uint32_t ) );
+  uint32_t *order = (uint32_t *) malloc( ( h.count + 1 ) * sizeof( uint32_t ) );
+  FrozenSlot *slots = (FrozenSlot *) malloc( ( h.count + 1 ) * sizeof( FrozenSlot ) );
+  char *data = NULL;
+  bool ok = g.ok && placePairs( g.pairs, h.count, h.buckets, seeds, order );
+
+  //lay out the records in slot order, each key next to its value
+  if ( ok ) {
+    h.seedsOff = sizeof( FrozenHeader );
+    h.slotsOff = h.seedsOff + ( ( h.buckets * sizeof( uint32_t ) + 7 ) & ~(size_t) 7 );
+    h.dataOff = h.slotsOff + h.count * sizeof( FrozenSlot );
+
+    size_t dataLen = 0;
+    for ( uint32_t i = 0; i < h.count; i++ )
+      dataLen += recordSize( &g.pairs[ i ].key ) + recordSize( &g.pairs[ i ].val );
+    h.size = h.dataOff + dataLen;
+    ok = h.size <= UINT32_MAX;
+
+    data = (char *) malloc( dataLen + 1 );
+    size_t off = 0;
+    for ( uint32_t i = 0; ok && i < h.count; i++ ) {
+      FreezePair const *p = &g.pairs[ order[ i ] ];
+      slots[ i ].hash = p->hash;
+      slots[ i ].keyOff = h.dataOff + off;
+      writeRecord( &p->key, data + off );
+      off += recordSize( &p->key );
+      slots[ i ].valOff = h.dataOff + off;
+      writeRecord( &p->val, data + off );
+      off += recordSize( &p->val );
+    }
+  }
+
+  //write the image out
+  if ( ok ) {
+    FILE *fp = fopen( path, "wb" );
+    uint64_t pad = 0;
+    ok = fp &&
+      fwrite( &h, sizeof( h ), 1, fp ) == 1 &&
+      fwrite( seeds, sizeof( uint32_t ), h.buckets, fp ) == h.buckets &&
+      fwrite( &pad, 1, h.slotsOff - h.seedsOff - h.buckets * sizeof( uint32_t ), fp ) ==
+        h.slotsOff - h.seedsOff - h.buckets * sizeof( uint32_t ) &&
+      fwrite( slots, sizeof( FrozenSlot ), h.count, fp ) == h.count &&
+      fwrite( data, 1, h.size - h.dataOff, fp ) == h.size - h.dataOff;
+    if ( fp && fclose( fp ) != 0 )
+      ok = false;
+  }
+
+  for ( uint32_t i = 0; i < g.count; i++ ) {
+    free( g.pairs[ i ].key.copy );
+    free( g.pairs[ i ].val.copy );
+  }
+  free( data );
+  free( slots );
+  free( order );
+  free( seeds );
+  free( g.pairs );
+  return ok;
+}
+
+FrozenMap *mapOpenFrozen( char const *path )
+{
+  int fd = open( path, O_RDONLY );
+  if ( fd < 0 )
+    return NULL;
+
+  //map the whole file, shared so other processes can use the same pages
+  struct stat st;
+  void *image = MAP_FAILED;
+  if ( fstat( fd, &st ) == 0 && st.st_size >= (off_t) sizeof( FrozenHeader ) )
+    image = mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+  close( fd );
+  if ( image == MAP_FAILED )
+    return NULL;
+
+  //check the header describes an image that fits in the file
+  FrozenHeader const *h = (FrozenHeader const *) image;
+  if ( memcmp( h->magic, FROZEN_MAGIC, sizeof( h->magic ) ) != 0 ||
+       h->size != (uint64_t) st.st_size || h->buckets == 0 ||
+       h->seedsOff + (uint64_t) h->buckets * sizeof( uint32_t ) > h->slotsOff ||
+       h->slotsOff + (uint64_t) h->count * sizeof( FrozenSlot ) > h->dataOff ||
+       h->dataOff > h->size ) {
+    munmap( image, st.st_size );
+    return NULL;
+  }
+
+  FrozenMap *f = (FrozenMap *) malloc( sizeof( FrozenMap ) );
+  f->image = (char const *) image;
+  f->size = st.st_size;
+  f->count = h->count;
+  f->buckets = h->buckets;
+  f->seeds = (uint32_t const *) ( f->image + h->seedsOff );
+  f->slots = (FrozenSlot const *) ( f->image + h->slotsOff );
+  return f;
+}
+
+int frozenSize( FrozenMap *f )
+{
+  return f->count;
+}
+
+/**
+ * Find a record in an image, making sure it lies inside the image.
+ * @param f Frozen map the record is in.
+ * @param off Offset of the record.
+ * @return FrozenRecord const* the record, or null if it's out of bounds.
+ */
+static FrozenRecord const *recordAt( FrozenMap *f, uint32_t off )
+{
+  if ( (size_t) off + sizeof( FrozenRecord ) > f->size )
+    return NULL;
+  FrozenRecord const *r = (FrozenRecord const *) ( f->image + off );
+  if ( (size_t) off + sizeof( FrozenRecord ) + r->len + ( r->kind == FROZEN_TEXT ) > f->size )
+    return NULL;
+  return r;
+}
+
+VType *frozenGet( FrozenMap *f, VType *key, FrozenValue *val )
+{
+  Encoded k;
+  if ( f->count == 0 || !encode( key, &k ) )
+    return NULL;
+
+  //the key's bucket seed leads straight to the only slot it can be in
+  uint64_t h = hashEncoded( &k );
+  FrozenSlot const *slot =
+    &f->slots[ slotOf( h, f->seeds[ bucketOf( h, f->buckets ) ], f->count ) ];
+  FrozenRecord const *r = slot->hash == h ? recordAt( f, slot->keyOff ) : NULL;
+  bool match = r && r->kind == k.kind && r->len == k.len &&
+    memcmp( r->data, k.bytes, k.len ) == 0;
+  free( k.copy );
+  if ( !match )
+    return NULL;
+
+  //fill in the caller's storage, pointing into the image for strings
+  FrozenRecord const *v = recordAt( f, slot->valOff );
+  if ( !v )
+    return NULL;
+  if ( v->kind == FROZEN_INTEGER ) {
+    int i;
+    memcpy( &i, v->data, sizeof( int ) );
+    initInteger( &val->integer, i );
+  } else
+    initText( &val->text, v->data );
+
+  return &val->vtype;
+}
+
+void freeFrozenMap( FrozenMap *f )
+{
+  munmap( (void *) f->image, f->size );
+  free( f );
+}
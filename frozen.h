@@ -0,0 +1,85 @@
+/**
+    @file frozen.h
+    @author
+    Header for the frozen map component, a read-only image of a map built
+    around a minimal perfect hash.  A map is frozen once, offline, into a
+    file; opening the file maps it into memory without reading or
+    rebuilding anything, so startup takes the same time for any size of
+    map, and processes opening the same file share its pages.  Every
+    lookup probes exactly one slot and allocates nothing.
+
+    Images hold Integer and Text keys and values.  They're written in the
+    machine's own byte order, for use on the machine that built them.
+*/
+
+#ifndef FROZEN_H
+#define FROZEN_H
+
+#include <stdbool.h>
+
+#include "vtype.h"
+#include "map.h"
+#include "integer.h"
+#include "text.h"
+
+/** Incomplete type for an open frozen map. */
+typedef struct FrozenMapStruct FrozenMap;
+
+/** Storage for a value looked up in a frozen map, big enough for any
+    kind of value an image can hold. */
+typedef union {
+  /** The value, as a VType. */
+  VType vtype;
+
+  /** The value, if it's an Integer. */
+  Integer integer;
+
+  /** The value, if it's a Text. */
+  Text text;
+} FrozenValue;
+
+/**
+ * Write an image of the given map to a file, to open later with
+ * mapOpenFrozen.  The map itself isn't changed.
+ * @param m Map to freeze.
+ * @param path Name of the file to write.
+ * @return bool true if the image was written, false if the map holds a
+ * key or value that isn't an Integer or Text, or the file couldn't be
+ * written.
+ */
+bool mapFreeze( Map *m, char const *path );
+
+/**
+ * Open an image written by mapFreeze.  The file is mapped read-only and
+ * shared, and nothing in it is read until it's used.
+ * @param path Name of the image file.
+ * @return FrozenMap* the open map, or null if the file can't be mapped or
+ * isn't an image.
+ */
+FrozenMap *mapOpenFrozen( char const *path );
+
+/**
+ * Get the number of key/value pairs in a frozen map.
+ * @param f Pointer to the frozen map.
+ * @return int number of keys.
+ */
+int frozenSize( FrozenMap *f );
+
+/**
+ * Look up the value for a key in a frozen map.  The value is filled in
+ * the caller's storage and refers to the image for any string it has, so
+ * it's only good until the map is freed, and it must not be destroyed.
+ * @param f Pointer to the frozen map.
+ * @param key Key to look up.
+ * @param val Storage for the value.
+ * @return VType* the value, in val, or null if the key isn't in the map.
+ */
+VType *frozenGet( FrozenMap *f, VType *key, FrozenValue *val );
+
+/**
+ * Unmap a frozen map and free the little memory it uses.
+ * @param f The frozen map to free.
+ */
+void freeFrozenMap( FrozenMap *f );
+
+#endif
@@ -49,6 +49,25 @@ static void destroy( VType *v )
   free( v );
 }
 
+void initInteger( Integer *this, int val )
+{
+  this->val = val;
+  this->print = print;
+  this->equals = equals;
+  this->hash = hash;
+  this->destroy = destroy;
+}
+
+VType *makeInteger( int val )
+{
+  // Allocate an Integer on the heap and fill in its fields.
+  Integer *this = (Integer *) malloc( sizeof( Integer ) );
+  initInteger( this, val );
+
+  // Return it as a poitner to the superclass.
+  return (VType *) this;
+}
+
 VType *parseInteger( char const *init, int *n )
 {
   // Make sure the string is in the right format.
@@ -61,14 +80,11 @@ VType *parseInteger( char const *init, int *n )
   if ( n )
     *n = len;
   
-  // Allocate an Integer on the heap and fill in its fields.
-  Integer *this = (Integer *) malloc( sizeof( Integer ) );
-  this->val = val;
-  this->print = print;
-  this->equals = equals;
-  this->hash = hash;
-  this->destroy = destroy;
+  return makeInteger( val );
+}
 
-  // Return it as a poitner to the superclass.
-  return (VType *) this;
+bool isInteger( VType const *v )
+{
+  // Integers are the only values that use this print function.
+  return v->print == print;
 }
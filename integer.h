@@ -35,4 +35,23 @@ typedef struct {
 */
 VType *parseInteger( char const *init, int *n );
 
+/** Make an instance of Integer holding the given value.
+    @param val Value for the integer to hold.
+    @return pointer to the new VType instance.
+*/
+VType *makeInteger( int val );
+
+/** Fill in an Integer that lives in caller-provided storage, such as a
+    temporary key on the stack.  It must not be destroyed.
+    @param this Integer to initialize.
+    @param val Value for the integer to hold.
+*/
+void initInteger( Integer *this, int val );
+
+/** Report whether the given value is an instance of Integer.
+    @param v Pointer to the value to check.
+    @return True if v is an Integer.
+*/
+bool isInteger( VType const *v );
+
 #endif
@@ -4,23 +4,145 @@
     Hash table implementation of a map.
 */
 
+// mmap's MAP_ANONYMOUS and madvise's huge page advice aren't part of C99.
+#define _DEFAULT_SOURCE
+
 #include "map.h"
 #include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/mman.h>
 
 #include "vtype.h"
+#include "integer.h"
+#include "text.h"
+#include "skiplist.h"
+#include "bloom.h"
+#include "cuckoo.h"
+
+/** Size of a huge page.  Tables at least this big are mapped on their
+    own when the map uses huge tables; smaller ones aren't worth it. */
+#define HUGE_PAGE_SIZE ( 2 * 1024 * 1024 )
+
+/** Number of slots in the hot-key cache, a power of two. */
+#define CACHE_SLOTS 256
+
+/** A list longer than this gets a tree of its nodes, ordered by hash, so
+    lookups and changes in it take a tree search instead of a walk. */
+#define SORT_LEN 16
 
-/** Node containing a key / value pair. */
+/** A sorted list goes back to being just a list at this length.  It's
+    well below SORT_LEN, so a list near the limit doesn't flip back and
+    forth. */
+#define UNSORT_LEN 8
+
+/** The table shrinks when fewer than 1 / SHRINK_LOAD of its elements
+    are in use.  Since it only shrinks by half, a table that just shrank
+    is still half full and won't grow again right away. */
+#define SHRINK_LOAD 4
+
+/** Node containing a key / value pair.  A node made with inline entries
+    is followed, in the same allocation, by a copy of its value and then
+    of its key, each with its string if it's a Text. */
 typedef struct NodeStruct {
   /** Pointer to the key part of the key / value pair. */
   VType *key;
   
   /** Pointer to the value part of the key / value pair. */
   VType *val;
+
+  /** Hash of the key, cached so resizing and mismatches don't recompute it. */
+  unsigned int hash;
+
+  /** True if the key is stored in the node itself. */
+  bool keyInline;
+
+  /** True if the node was made with room for its value.  The value is
+      only still there if val points to that room, since a caller can
+      replace it through mapEntry. */
+  bool valInline;
   
   /** Pointer to the next node at the same element of this table. */
   struct NodeStruct *next;
 } Node;
 
+/** Entry of a long list's tree, one for each node of the list. */
+typedef struct {
+  /** Node this entry is for. */
+  Node *node;
+
+  /** Random priority, larger than the priorities of the entry's children. */
+  unsigned int prio;
+
+  /** Index of the subtree of nodes before this one, or -1. */
+  int left;
+
+  /** Index of the subtree of nodes after this one, or -1. */
+  int right;
+} SortedEntry;
+
+/** The nodes of one long list in a treap ordered by their hashes, so
+    they're found, added and removed in logarithmic time.  The list itself
+    is kept in the same order, so the tree also gives the node in front of
+    any node, for unlinking it. */
+typedef struct {
+  /** Entries of the tree, with released ones chained through left. */
+  SortedEntry *entries;
+
+  /** Index of the root entry, or -1. */
+  int root;
+
+  /** Index of the first released entry, or -1. */
+  int free;
+
+  /** Number of nodes in the tree. */
+  int len;
+
+  /** Number of entries handed out, released or not. */
+  int used;
+
+  /** Capacity of the entries array. */
+  int cap;
+
+  /** State for picking priorities. */
+  unsigned int seed;
+} SortedList;
+
+/** Values of a map in dense mode, indexed directly by Integer key. */
+typedef struct {
+  /** Smallest key in the range. */
+  int lo;
+
+  /** Number of keys in the range. */
+  int len;
+
+  /** Value for each key in the range. */
+  VType **vals;
+
+  /** One bit for each key in the range, set if the key is in the map. */
+  unsigned long long *occupied;
+} DenseArray;
+
+/** Number of keys each word of the occupancy bitmap covers. */
+#define DENSE_WORD_BITS 64
+
+/** A list of nodes or a key or value the map has let go of, which a
+    snapshot may still be using. */
+typedef struct RetiredStruct {
+  /** Key or value to destroy, or null. */
+  VType *vtype;
+
+  /** List of nodes to free, or null.  Their keys and values aren't freed. */
+  Node *chain;
+
+  /** Generation of the map when this was retired.  Snapshots taken
+      after that can't be using it. */
+  unsigned int gen;
+
+  /** Next retired item, retired earlier than this one. */
+  struct RetiredStruct *next;
+} Retired;
+
 /** Representation of a hash table implementation of a map. */
 struct MapStruct {
   /** Table of key / value pairs. */
@@ -28,17 +150,124 @@ struct MapStruct {
 
   /** Current length of the table. */
   int tlen;
+
+  /** True if large tables should be mapped with huge pages. */
+  bool hugeTable;
+
+  /** True if the table was mapped with mmap rather than allocated. */
+  bool tableMapped;
+
+  /** True if new nodes hold copies of their Integer and Text keys and
+      values, rather than pointing to them. */
+  bool inlineEntries;
+
+  /** Initial length of the table, automatic shrinking stops here. */
+  int minLen;
   
   /** Current size of the map (number of different keys). */
   int size;
+
+  /** Values stored by key, or null if the map isn't in dense mode.  In
+      dense mode the table is empty. */
+  DenseArray *dense;
+
+  /** Cuckoo table of the keys and values, or null if the map keeps them
+      in nodes.  In cuckoo mode the table of lists is empty. */
+  Cuckoo *cuckoo;
+
+  /** Sorted tree for each list longer than SORT_LEN, or null if no
+      list is that long. */
+  SortedList **sorted;
+
+  /** Ordered index of the Integer keys, or null if it isn't enabled. */
+  SkipList *index;
+
+  /** Filter over the hashes of the keys, or null if it isn't enabled. */
+  Bloom *bloom;
+
+  /** Counts of filter results, reported by mapBloomStats. */
+  MapBloomStats bloomStats;
+
+  /** Recently found nodes, indexed by the low bits of their hash, or null
+      if the cache isn't enabled. */
+  Node **cache;
+
+  /** Counts of cache results, reported by mapCacheStats. */
+  MapCacheStats cacheStats;
+
+  /** Pool the Text keys and values are interned in, or null if interning
+      isn't enabled. */
+  TextPool *pool;
+
+  /** Live snapshots of the map, newest first, or null if there aren't any. */
+  MapSnapshot *snapshots;
+
+  /** Generation of the map, advanced by every snapshot. */
+  unsigned int gen;
+
+  /** Generation when each list was last copied for the map's own use.  A
+      list older than the newest snapshot is shared with it.  Null when
+      there are no snapshots. */
+  unsigned int *bucketGen;
+
+  /** Things the map has let go of that snapshots may still be using. */
+  Retired *retired;
+};
+
+/** Representation of a read-only, point-in-time view of a map. */
+struct MapSnapshotStruct {
+  /** Map this is a snapshot of. */
+  Map *map;
+
+  /** Copy of the map's table of lists when the snapshot was taken. */
+  Node **table;
+
+  /** Length of the table. */
+  int tlen;
+
+  /** Number of key / value pairs in the snapshot. */
+  int size;
+
+  /** Generation of the map this snapshot was taken at. */
+  unsigned int gen;
+
+  /** Next older live snapshot of the same map. */
+  struct MapSnapshotStruct *next;
 };
 
+/** Visit state passed through the ordered index or the cuckoo table. */
+typedef struct {
+  /** Map the range query is for. */
+  Map *map;
+
+  /** Function to call on each key/value pair in the range. */
+  void (*visit)( VType const *key, VType *val, void *data );
+
+  /** Caller's data for the visit function. */
+  void *data;
+} RangeQuery;
+
 Map *makeMap( int len )
 {
   Map *m = (Map *) malloc( sizeof( Map ) );
   m->size = 0;
-  m->tlen = len;
-  m->table = (Node **) malloc( m->tlen * sizeof( Node* ) );
+  m->tlen = len > 0 ? len : 1;
+  m->minLen = m->tlen;
+  m->table = (Node **) calloc( m->tlen, sizeof( Node* ) );
+  m->hugeTable = false;
+  m->tableMapped = false;
+  m->inlineEntries = false;
+  m->dense = NULL;
+  m->cuckoo = NULL;
+  m->sorted = NULL;
+  m->index = NULL;
+  m->bloom = NULL;
+  m->cache = NULL;
+  m->pool = NULL;
+  m->snapshots = NULL;
+  m->gen = 0;
+  m->bucketGen = NULL;
+  m->retired = NULL;
   
   return m;
 }
@@ -48,245 +277,1670 @@ int mapSize( Map *m )
   return m->size;
 }
 
+int mapCapacity( Map *m )
+{
+  return m->cuckoo ? cuckooCapacity( m->cuckoo ) : m->tlen;
+}
+
 /**
- * Search the map for given key and return the NODE with the given key.
- * If the key does not exist in the map, return null.
- * @param m Map to query.
- * @param key Key to look for in the map.
- * @return Node* Node associated with the given key.
- *               Null if the key does not exist in the map.
+ * Drop a node from the hot-key cache, if it's there, because it's about
+ * to be freed or replaced by a copy.
+ * @param m Map the node belongs to.
+ * @param n Node to forget.
  */
-static Node *mapSearch( Map *m, VType *key )
+static void uncacheNode( Map *m, Node *n )
 {
-  //calculate the hash of the key
-  int keyIndex = key->hash( key ) % m->tlen;
-  //default the return value to null
-  Node *returnVal = NULL;
+  if ( m->cache && m->cache[ n->hash & ( CACHE_SLOTS - 1 ) ] == n )
+    m->cache[ n->hash & ( CACHE_SLOTS - 1 ) ] = NULL;
+}
 
-  //loop through the probed linear list and find the node with the same key as parameter key
-  for( Node *current = m->table[ keyIndex ]; current; current = current->next )
-    if( key->equals( key, current->key ) )
-      returnVal = current;
+/**
+ * Report whether the given list of the map is shared with a snapshot.
+ * @param m Map to check.
+ * @param i Index of the list in the map's table.
+ * @return true if a snapshot is using the list.
+ */
+static bool bucketShared( Map *m, int i )
+{
+  return m->snapshots && m->bucketGen[ i ] < m->snapshots->gen;
+}
 
-  return returnVal;
+/**
+ * Hand something the map no longer uses over to its snapshots, to be
+ * freed once every snapshot that could be using it is gone.
+ * @param m Map that let go of it.
+ * @param vtype Key or value to destroy later, or null.
+ * @param chain List of nodes to free later, or null.
+ */
+static void retire( Map *m, VType *vtype, Node *chain )
+{
+  if ( !vtype && !chain )
+    return;
 
+  Retired *r = (Retired *) malloc( sizeof( Retired ) );
+  r->vtype = vtype;
+  r->chain = chain;
+  r->gen = m->gen;
+  r->next = m->retired;
+  m->retired = r;
 }
 
-VType *mapGet( Map *m, VType *key )
+/**
+ * Free a key or value the map no longer uses, or retire it if a snapshot
+ * might still be using it.
+ * @param m Map that let go of it.
+ * @param v Key or value to free.
+ */
+static void releaseVType( Map *m, VType *v )
 {
-  //find the Node in the map with the given key
-  Node *keyNode = mapSearch( m, key );
+  if ( m->snapshots )
+    retire( m, v, NULL );
+  else
+    v->destroy( v );
+}
 
-  //if the node exists, return its value
-  if ( keyNode )
-    return keyNode->val;
+/**
+ * Report how many bytes a node needs to hold a copy of a key or value.
+ * @param v Key or value to copy.
+ * @return size_t bytes for the copy and its string, kept a multiple of
+ * the size of a pointer, or zero if it isn't an Integer or Text.
+ */
+static size_t inlineBytes( VType const *v )
+{
+  if ( isInteger( v ) )
+    return sizeof( Integer );
+  if ( !isText( v ) )
+    return 0;
+  size_t len = strlen( ( (Text const *) v )->str ) + 1;
+  return sizeof( Text ) + ( len + sizeof( void * ) - 1 ) / sizeof( void * ) * sizeof( void * );
+}
 
-  //if not, return null
-  else
-    return NULL;
+/**
+ * Copy an Integer or Text into storage in a node, and destroy the original.
+ * A Text's string goes right after it.  The copy belongs to the node, and
+ * is freed with it rather than destroyed.
+ * @param v Key or value to copy.
+ * @param dest Storage for the copy, inlineBytes( v ) long.
+ * @return VType* the copy.
+ */
+static VType *copyInline( VType *v, char *dest )
+{
+  if ( isInteger( v ) )
+    memcpy( dest, v, sizeof( Integer ) );
+  else {
+    Text *t = (Text *) dest;
+    memcpy( t, v, sizeof( Text ) );
+    t->str = dest + sizeof( Text );
+    t->pool = NULL;
+    strcpy( t->str, ( (Text *) v )->str );
+  }
+
+  v->destroy( v );
+  return (VType *) dest;
 }
 
 /**
- * Frees all the memory used by the node n.
- * @param n the node in question.
+ * Report whether a node's value is the copy stored in the node.
+ * @param n Node to check.
+ * @return bool true if the value is freed with the node.
  */
-static void freeNode( Node *n )
+static bool valIsInline( Node const *n )
 {
-  if ( n->key->print )
-    n->key->destroy( n->key );
-  if ( n->val->print )
-    n->val->destroy( n->val );
-  free( n );
+  return n->valInline && n->val == (VType const *) ( n + 1 );
 }
 
-void mapSet( Map *m, VType *key, VType *value )
+/**
+ * Make a new node for a key and value.  With inline entries, an Integer
+ * or Text key or value is copied into the node and the original destroyed.
+ * @param m Map the node is for.
+ * @param key Key for the node.
+ * @param val Value for the node, or null if the caller fills it in later.
+ * @param h Hash of the key.
+ * @return Node* the new node, with a null next pointer.
+ */
+static Node *makeNode( Map *m, VType *key, VType *val, unsigned int h )
 {
-  //first search the map for the given key
-  Node *keyNode = mapSearch( m, key );
+  size_t keyBytes = m->inlineEntries ? inlineBytes( key ) : 0;
+  size_t valBytes = m->inlineEntries && val ? inlineBytes( val ) : 0;
+  Node *n = (Node *) malloc( sizeof( Node ) + valBytes + keyBytes );
+  char *tail = (char *) ( n + 1 );
 
-  //if the node exists, replace its value and free the old keys and values
-  if( keyNode ) {
-    keyNode->key->destroy( keyNode->key );
-    keyNode->val->destroy( keyNode->val );
-    keyNode->key = key;
-    keyNode->val = value;
+  n->valInline = valBytes > 0;
+  n->val = valBytes ? copyInline( val, tail ) : val;
+  n->keyInline = keyBytes > 0;
+  n->key = keyBytes ? copyInline( key, tail + valBytes ) : key;
+  n->hash = h;
+  n->next = NULL;
+  return n;
+}
 
-  //if the node does not exist, create it and add it to map
-  } else {
+/**
+ * Move a pointer into one node to the same place in a copy of it.
+ * @param p Pointer into the original node.
+ * @param from The original node.
+ * @param size Size of the original node.
+ * @param to The copy.
+ * @return void* the pointer moved into the copy, or p unchanged if it
+ * doesn't point into the original.
+ */
+static void *relocate( void *p, Node *from, size_t size, Node *to )
+{
+  char *c = (char *) p;
+  if ( c < (char *) from || c >= (char *) from + size )
+    return p;
+  return (char *) to + ( c - (char *) from );
+}
 
-    // //EXTRA CREDIT: resize the map if the number of entries is equal to the number of the length of the hash table
-    if ( m->size == m->tlen ) {
-
-      //the new table length is double the old one
-      int newTLen = m->tlen * 2;
-      
-      //create a new table with double the length
-      Node **newTable = malloc( newTLen * sizeof(Node *) );
-
-      //for every linked list in the original table...
-      for( int i = 0; i < m->tlen; i++ ) {
-
-        //create a pointer to node pointer and have it point to the head of each linked list
-        Node **link = malloc( sizeof(Node *) );
-        *link = m->table[ i ];
-
-        //while there are nodes in the linked list
-        while( *link ) {
-
-          //make a copy of the old node with a null next pointer
-          Node *newNode = (Node *) malloc( sizeof( Node ) );
-          newNode->key = (*link)->key;
-          newNode->val = (*link)->val;
-          newNode->next = NULL;
-          
-          //calcualte the new hashed index of the node's key
-          int newKeyIndex = (*link)->key->hash( (*link)->key ) % newTLen;
-
-          //add the node to the new table
-          //special case: first node in linked list
-          if( !newTable[ newKeyIndex ] )
-            newTable[ newKeyIndex ] = newNode;
-
-          //add node to end of linked list
-          else {
-            
-            //get the first node in the list
-            Node *current = newTable[ newKeyIndex ];
-
-            //iterate through the list until we're at the last node in the list
-            while( current->next )
-              current = current->next;
-
-            //add the new node to the list and iterate size
-            current->next = newNode;
-
-          }
-
-          //remove the node from the old table
-          Node *nextNode = (*link)->next;
-          free( *link );
-          *link = nextNode;
-        }
-
-        //free the space used by the linker
-        free( link );
-      }
+/**
+ * Make a copy of a node, sharing its key and value, or copying them if
+ * they're stored in the node.
+ * @param n Node to copy.
+ * @return Node* the new node, with a null next pointer.
+ */
+static Node *copyNode( Node *n )
+{
+  size_t valBytes = n->valInline ? inlineBytes( (VType *) ( n + 1 ) ) : 0;
+  size_t keyBytes = n->keyInline ? inlineBytes( n->key ) : 0;
+  size_t size = sizeof( Node ) + valBytes + keyBytes;
+  Node *c = (Node *) malloc( size );
+  memcpy( c, n, size );
+
+  //copies held in the node, and their strings, move with it
+  c->key = relocate( n->key, n, size, c );
+  c->val = relocate( n->val, n, size, c );
+  if ( valBytes && isText( (VType *) ( c + 1 ) ) ) {
+    Text *t = (Text *) ( c + 1 );
+    t->str = relocate( t->str, n, size, c );
+  }
+  if ( keyBytes && isText( c->key ) ) {
+    Text *t = (Text *) c->key;
+    t->str = relocate( t->str, n, size, c );
+  }
+
+  c->next = NULL;
+  return c;
+}
+
+/**
+ * Order two tree entries by the hashes of their nodes, for qsort.
+ * @param a Pointer to the first entry.
+ * @param b Pointer to the second entry.
+ * @return int negative, zero or positive as a's hash is less, equal or greater.
+ */
+static int compareHashes( void const *a, void const *b )
+{
+  unsigned int x = ( (SortedEntry const *) a )->node->hash;
+  unsigned int y = ( (SortedEntry const *) b )->node->hash;
+  return x < y ? -1 : x > y;
+}
 
-      //set the old map's table to be the new map
-      free( m->table );
-      m->table = newTable;
-      m->tlen = newTLen;
+/**
+ * Get a tree entry for a node, reusing a released one if there is one.
+ * The entries may move, so this comes before holding pointers to them.
+ * @param sl Sorted list to add the entry to.
+ * @param n Node for the entry.
+ * @return int index of the new entry, with no children.
+ */
+static int sortedEntry( SortedList *sl, Node *n )
+{
+  int e = sl->free;
+  if ( e >= 0 )
+    sl->free = sl->entries[ e ].left;
+  else {
+    if ( sl->used == sl->cap ) {
+      sl->cap *= 2;
+      sl->entries = (SortedEntry *) realloc( sl->entries, sl->cap * sizeof( SortedEntry ) );
     }
+    e = sl->used++;
+  }
+
+  //xorshift, so priorities are random without depending on the keys
+  sl->seed ^= sl->seed << 13;
+  sl->seed ^= sl->seed >> 17;
+  sl->seed ^= sl->seed << 5;
+  sl->entries[ e ].node = n;
+  sl->entries[ e ].prio = sl->seed;
+  sl->entries[ e ].left = sl->entries[ e ].right = -1;
+  return e;
+}
+
+/**
+ * Fill a list's tree with its nodes, and relink the list in hash order
+ * to match.
+ * @param sl Sorted list to fill.
+ * @param head Link to the first node of the list.
+ */
+static void fillSorted( SortedList *sl, Node **head )
+{
+  sl->len = sl->used = 0;
+  sl->free = -1;
+  for ( Node *current = *head; current; current = current->next ) {
+    sortedEntry( sl, current );
+    sl->len++;
+  }
+  qsort( sl->entries, sl->len, sizeof( SortedEntry ), compareHashes );
 
-    //create the new node and set its fields
-    Node *newNode = (Node *) malloc( sizeof( Node ) );
-    newNode->key = key;
-    newNode->val = value;
-    newNode->next = NULL;
+  for ( int k = 0; k < sl->len; k++ ) {
+    *head = sl->entries[ k ].node;
+    head = &(*head)->next;
+  }
+  *head = NULL;
 
-    //calcualte index the key hashes to
-    int keyIndex = key->hash( key ) % m->tlen;
+  //build the tree in one pass, keeping the right spine on a stack
+  int *spine = (int *) malloc( sl->len * sizeof( int ) );
+  int top = 0;
+  for ( int k = 0; k < sl->len; k++ ) {
+    int last = -1;
+    while ( top > 0 && sl->entries[ spine[ top - 1 ] ].prio < sl->entries[ k ].prio )
+      last = spine[ --top ];
+    sl->entries[ k ].left = last;
+    if ( top > 0 )
+      sl->entries[ spine[ top - 1 ] ].right = k;
+    spine[ top++ ] = k;
+  }
+  sl->root = top > 0 ? spine[ 0 ] : -1;
+  free( spine );
+}
 
-    //special case: first node in linked list
-    if ( !m->table[ keyIndex ] ) {
-      m->table[ keyIndex ] = newNode;
-      m->size++;
+/**
+ * Give one of the map's lists a sorted tree, if it's long enough to
+ * need one and doesn't have one yet.
+ * @param m Map the list is in.
+ * @param i Index of the list in the map's table.
+ */
+static void sortIfLong( Map *m, int i )
+{
+  if ( m->sorted && m->sorted[ i ] )
+    return;
 
-    //add node to end of linked list
-    } else {
+  //only count as far as the limit
+  int len = 0;
+  for ( Node *current = m->table[ i ]; current && len <= SORT_LEN; current = current->next )
+    len++;
+  if ( len <= SORT_LEN )
+    return;
 
-      //get the first node in the list
-      Node *current = m->table[ keyIndex ];
+  if ( !m->sorted )
+    m->sorted = (SortedList **) calloc( m->tlen, sizeof( SortedList * ) );
+  SortedList *sl = (SortedList *) malloc( sizeof( SortedList ) );
+  sl->cap = 2 * SORT_LEN;
+  sl->entries = (SortedEntry *) malloc( sl->cap * sizeof( SortedEntry ) );
+  sl->seed = 2463534242u;
+  fillSorted( sl, &m->table[ i ] );
+  m->sorted[ i ] = sl;
+}
 
-      //iterate through the list until we're at the last node in the list
-      while( current->next )
-        current = current->next;
+/**
+ * Free one of the map's sorted trees, if it has one.
+ * @param m Map the list is in.
+ * @param i Index of the list in the map's table.
+ */
+static void unsort( Map *m, int i )
+{
+  if ( m->sorted && m->sorted[ i ] ) {
+    free( m->sorted[ i ]->entries );
+    free( m->sorted[ i ] );
+    m->sorted[ i ] = NULL;
+  }
+}
 
-      //add the new node to the list and iterate size
-      current->next = newNode;
-      m->size++;
+/**
+ * Free all of the map's sorted trees.
+ * @param m Map to free them for.
+ */
+static void freeSorted( Map *m )
+{
+  if ( !m->sorted )
+    return;
+  for ( int i = 0; i < m->tlen; i++ )
+    unsort( m, i );
+  free( m->sorted );
+  m->sorted = NULL;
+}
 
-    }
+/**
+ * Find the last node in a sorted list with a hash less than h.
+ * @param sl Sorted list to search.
+ * @param h Hash to look for.
+ * @return Node* the node, or null if no hash is less.
+ */
+static Node *sortedBefore( SortedList *sl, unsigned int h )
+{
+  Node *before = NULL;
+  for ( int t = sl->root; t >= 0; ) {
+    SortedEntry *e = &sl->entries[ t ];
+    if ( e->node->hash < h ) {
+      before = e->node;
+      t = e->right;
+    } else
+      t = e->left;
+  }
+  return before;
+}
 
+/**
+ * Find the first node in a sorted list with a hash not less than h.
+ * @param sl Sorted list to search.
+ * @param h Hash to look for.
+ * @return Node* the node, or null if every hash is less.
+ */
+static Node *sortedLowerBound( SortedList *sl, unsigned int h )
+{
+  Node *first = NULL;
+  for ( int t = sl->root; t >= 0; ) {
+    SortedEntry *e = &sl->entries[ t ];
+    if ( e->node->hash < h )
+      t = e->right;
+    else {
+      first = e->node;
+      t = e->left;
+    }
   }
+  return first;
+}
 
+/**
+ * Find the node with the given key in a sorted list.  The list is in
+ * hash order, so nodes with the same hash follow the first one, and only
+ * they are compared with equals.
+ * @param sl Sorted list to search.
+ * @param key Key to look for.
+ * @param h Hash of the key.
+ * @return Node* the node with the key, or null.
+ */
+static Node *sortedFind( SortedList *sl, VType *key, unsigned int h )
+{
+  for ( Node *n = sortedLowerBound( sl, h ); n && n->hash == h; n = n->next )
+    if ( key->equals( key, n->key ) )
+      return n;
+  return NULL;
 }
 
-bool mapRemove( Map *m, VType *key )
+/**
+ * Split a subtree into the entries with hashes less than h and the rest.
+ * @param sl Sorted list the subtree is in.
+ * @param t Root of the subtree.
+ * @param h Hash to split at.
+ * @param less Set to the root of the entries with hashes less than h.
+ * @param rest Set to the root of the other entries.
+ */
+static void sortedSplit( SortedList *sl, int t, unsigned int h, int *less, int *rest )
+{
+  if ( t < 0 ) {
+    *less = *rest = -1;
+  } else if ( sl->entries[ t ].node->hash < h ) {
+    sortedSplit( sl, sl->entries[ t ].right, h, &sl->entries[ t ].right, rest );
+    *less = t;
+  } else {
+    sortedSplit( sl, sl->entries[ t ].left, h, less, &sl->entries[ t ].left );
+    *rest = t;
+  }
+}
+
+/**
+ * Join two subtrees, where every entry of the first comes before every
+ * entry of the second.
+ * @param sl Sorted list the subtrees are in.
+ * @param a Root of the first subtree.
+ * @param b Root of the second subtree.
+ * @return int root of the joined tree.
+ */
+static int sortedMerge( SortedList *sl, int a, int b )
 {
-  //search the map for the node with the given key
-  Node *keyNode = mapSearch( m, key );
+  if ( a < 0 )
+    return b;
+  if ( b < 0 )
+    return a;
+  if ( sl->entries[ a ].prio > sl->entries[ b ].prio ) {
+    sl->entries[ a ].right = sortedMerge( sl, sl->entries[ a ].right, b );
+    return a;
+  }
+  sl->entries[ b ].left = sortedMerge( sl, a, sl->entries[ b ].left );
+  return b;
+}
 
-  //if the key does not exist in the map, return false
-  if( !keyNode )
-    return false;
+/**
+ * Take a node's entry out of a subtree.  Entries with the node's hash
+ * may be on either side, so both are searched for those.
+ * @param sl Sorted list the subtree is in.
+ * @param t Root of the subtree.
+ * @param n Node to take out.
+ * @return int root of the subtree without the node.
+ */
+static int sortedDelete( SortedList *sl, int t, Node *n )
+{
+  if ( t < 0 )
+    return t;
+  SortedEntry *e = &sl->entries[ t ];
+  if ( e->node == n ) {
+    int joined = sortedMerge( sl, e->left, e->right );
+    e->left = sl->free;
+    sl->free = t;
+    sl->len--;
+    return joined;
+  }
 
-  //if the key does exist in the map, remove it
-  else {
-    
-    //calcualte index the key hashes to
-    int keyIndex = key->hash( key ) % m->tlen;
+  int len = sl->len;
+  if ( n->hash <= e->node->hash )
+    e->left = sortedDelete( sl, e->left, n );
+  if ( sl->len == len && n->hash >= e->node->hash )
+    e->right = sortedDelete( sl, e->right, n );
+  return t;
+}
 
-    //special case: node to be removed is first in list
-    if( key->equals( key, m->table[ keyIndex ]->key) ) {
+/**
+ * Link a new node into one of the map's lists.  A list with a sorted tree
+ * is kept in hash order, so the node goes right after the last node with
+ * a smaller hash.  Any other list takes it at the given link, and gets a
+ * tree if that made it too long.
+ * @param m Map the node is being added to.
+ * @param i Index of the node's list in the map's table.
+ * @param link Where the node goes in a list without a tree.
+ * @param n Node to add.
+ */
+static void linkNode( Map *m, int i, Node **link, Node *n )
+{
+  SortedList *sl = m->sorted ? m->sorted[ i ] : NULL;
+  if ( !sl ) {
+    n->next = *link;
+    *link = n;
+    sortIfLong( m, i );
+    return;
+  }
 
-      //store reference to old node so it can be freed from memory
-      Node *oldNode = m->table[ keyIndex ];
+  int e = sortedEntry( sl, n );
+  Node *before = sortedBefore( sl, n->hash );
+  link = before ? &before->next : &m->table[ i ];
+  n->next = *link;
+  *link = n;
 
-      //remove the node from the list
-      m->table[ keyIndex ] = oldNode->next;
-      m->size--;
+  int less, rest;
+  sortedSplit( sl, sl->root, n->hash, &less, &rest );
+  sl->root = sortedMerge( sl, sortedMerge( sl, less, e ), rest );
+  sl->len++;
+}
 
-      //free the memory from the old node
-      freeNode( oldNode );
-    }
+/**
+ * Unlink a node from one of the map's lists, and drop the list's tree
+ * once the list is short again.
+ * @param m Map the node is being removed from.
+ * @param i Index of the node's list in the map's table.
+ * @param link Link to the node from a walk, or null if a tree found it.
+ * @param n Node to remove.
+ */
+static void unlinkNode( Map *m, int i, Node **link, Node *n )
+{
+  SortedList *sl = m->sorted ? m->sorted[ i ] : NULL;
 
-    //iterate through the list to find the node and remove it
-    else {
+  //the tree gives the last node with a smaller hash, and only nodes with
+  //the same hash can be between it and this one
+  if ( !link ) {
+    Node *before = sortedBefore( sl, n->hash );
+    link = before ? &before->next : &m->table[ i ];
+    while ( *link != n )
+      link = &(*link)->next;
+  }
+  *link = n->next;
 
-      //get the first node in the list
-      Node *current = m->table[ keyIndex ];
+  if ( sl ) {
+    sl->root = sortedDelete( sl, sl->root, n );
+    if ( sl->len <= UNSORT_LEN )
+      unsort( m, i );
+  }
+}
 
-      //iterate until the NEXT node's key is the key we're looking for
-      while ( !key->equals( key, current->next->key ) )
-        current = current->next;
+/**
+ * Before changing one of the map's lists, give the map its own copy of
+ * the list if it's shared with a snapshot.  The snapshots keep the
+ * original nodes.
+ * @param m Map that's about to change.
+ * @param i Index of the list in the map's table.
+ * @return true if the list was copied, so links into it are out of date.
+ */
+static bool unshareBucket( Map *m, int i )
+{
+  if ( !bucketShared( m, i ) )
+    return false;
 
-      //store reference to old node so it can be freed from memory
-      Node *oldNode = current->next;
+  //copy the list, keeping its order
+  Node *original = m->table[ i ];
+  Node **link = &m->table[ i ];
+  for ( Node *current = original; current; current = current->next ) {
+    uncacheNode( m, current );
+    *link = copyNode( current );
+    link = &(*link)->next;
+  }
 
-      //remove the node from the list
-      current->next = oldNode->next;
-      m->size--;
+  //the snapshots keep the original list, and the sorted tree has to
+  //point at the copies
+  retire( m, NULL, original );
+  m->bucketGen[ i ] = m->gen;
+  if ( m->sorted && m->sorted[ i ] )
+    fillSorted( m->sorted[ i ], &m->table[ i ] );
+  return true;
+}
 
-      //free memovry from the old node
-      freeNode( oldNode );
+/**
+ * Round the size of a table of the given length up to whole huge pages.
+ * @param len Length of the table.
+ * @return size_t number of bytes to map for it.
+ */
+static size_t mappedBytes( int len )
+{
+  size_t bytes = (size_t) len * sizeof( Node * );
+  return ( bytes + HUGE_PAGE_SIZE - 1 ) & ~( (size_t) HUGE_PAGE_SIZE - 1 );
+}
 
+/**
+ * Allocate an empty table for the map.  If the map uses huge tables and
+ * this one is big enough, it's mapped straight from the kernel, on
+ * reserved huge pages if there are any and otherwise with advice to back
+ * it with transparent huge pages.  Mapped pages come zeroed on first
+ * touch, so the table is never cleared by hand.
+ * @param m Map the table is for.
+ * @param len Length of the table.
+ * @param mapped Set to true if the table was mapped.
+ * @return Node** the new table, with every list empty.
+ */
+static Node **allocTable( Map *m, int len, bool *mapped )
+{
+#ifdef MAP_ANONYMOUS
+  if ( m->hugeTable && (size_t) len * sizeof( Node * ) >= HUGE_PAGE_SIZE ) {
+    size_t bytes = mappedBytes( len );
+    void *p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    p = mmap( NULL, bytes, PROT_READ | PROT_WRITE,
+              MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0 );
+#endif
+    if ( p == MAP_FAILED ) {
+      p = mmap( NULL, bytes, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+#ifdef MADV_HUGEPAGE
+      if ( p != MAP_FAILED )
+        madvise( p, bytes, MADV_HUGEPAGE );
+#endif
+    }
+    if ( p != MAP_FAILED ) {
+      *mapped = true;
+      return (Node **) p;
     }
+  }
+#endif
 
-    //return true indicating that the key-value pair was removed
-    return true;
+  *mapped = false;
+  return (Node **) calloc( len, sizeof( Node * ) );
+}
+
+/**
+ * Free the map's current table, returning mapped pages to the kernel.
+ * @param m Map whose table is being freed.
+ */
+static void freeTable( Map *m )
+{
+#ifdef MAP_ANONYMOUS
+  if ( m->tableMapped ) {
+    munmap( m->table, mappedBytes( m->tlen ) );
+    return;
   }
+#endif
+  free( m->table );
 }
 
-void freeMap( Map *m )
+/**
+ * Move every node in the map into a new table of the given length.
+ * The nodes themselves are relinked, not copied, except for lists shared
+ * with a snapshot.  The Bloom filter is sized to the table, so it's
+ * rebuilt along the way.
+ * @param m Map to resize.
+ * @param newTLen Length of the new table.
+ */
+static void resizeTable( Map *m, int newTLen )
 {
-  //free every node in the map's hashtable
+  //create a new, empty table
+  bool mapped;
+  Node **newTable = allocTable( m, newTLen, &mapped );
+
+  //and a new, empty filter to go with it
+  if ( m->bloom ) {
+    freeBloom( m->bloom );
+    m->bloom = makeBloom( newTLen );
+  }
+
+  //move every node of every linked list to the front of its new list
   for( int i = 0; i < m->tlen; i++ ) {
+    //a list a snapshot is using is copied instead, and left to the snapshot
+    bool shared = bucketShared( m, i );
+    if ( shared )
+      retire( m, NULL, m->table[ i ] );
 
-    //get the first node in the linked list
     Node *current = m->table[ i ];
-
-    //while current is not null, remove it
     while( current ) {
       Node *nextNode = current->next;
-      freeNode( current );
+      if ( shared )
+        uncacheNode( m, current );
+      Node *moved = shared ? copyNode( current ) : current;
+      int newKeyIndex = moved->hash % newTLen;
+      moved->next = newTable[ newKeyIndex ];
+      newTable[ newKeyIndex ] = moved;
+      if ( m->bloom )
+        bloomAdd( m->bloom, moved->hash );
       current = nextNode;
     }
+  }
+
+  //replace the old table with the new one
+  freeTable( m );
+  freeSorted( m );
+  m->table = newTable;
+  m->tlen = newTLen;
+  m->tableMapped = mapped;
+
+  //lists that are still long get sorted trees of their own
+  for ( int i = 0; i < newTLen; i++ )
+    sortIfLong( m, i );
 
+  //every list in the new table belongs to the map alone
+  if ( m->bucketGen ) {
+    free( m->bucketGen );
+    m->bucketGen = (unsigned int *) malloc( newTLen * sizeof( unsigned int ) );
+    for ( int i = 0; i < newTLen; i++ )
+      m->bucketGen[ i ] = m->gen;
   }
+}
 
-  //free the table itself
-  free( m->table );
+void mapReserve( Map *m, int n )
+{
+  if ( m->cuckoo ) {
+    cuckooReserve( m->cuckoo, n );
+    return;
+  }
+
+  //the table grows once size reaches its length, so make room for n
+  if ( n > m->tlen )
+    resizeTable( m, n );
+}
+
+void mapCompact( Map *m )
+{
+  //a cuckoo table packs its buckets right up to its load limit
+  if ( m->cuckoo ) {
+    cuckooCompact( m->cuckoo );
+    return;
+  }
+
+  //leave the table half full, the same as after an automatic shrink
+  int newTLen = m->size > 0 ? m->size * 2 : 1;
+  if ( newTLen < m->tlen )
+    resizeTable( m, newTLen );
+}
+
+/**
+ * Walk the list the given key hashes to, stopping at the link that points
+ * to the node with that key, or at the null link at the end of the list.
+ * Either way, the returned link is where a new node for the key belongs.
+ * @param m Map to query.
+ * @param key Key to look for in the map.
+ * @param h Hash of the key.
+ * @return Node** Link to the node with the given key, or to null.
+ */
+static Node **findLink( Map *m, VType *key, unsigned int h )
+{
+  Node **link = &m->table[ h % m->tlen ];
+
+  //compare cached hashes first, so most mismatches skip equals entirely
+  while( *link && ( (*link)->hash != h || !key->equals( key, (*link)->key ) ) )
+    link = &(*link)->next;
+
+  return link;
+}
+
+/**
+ * Find the node with the given key, with a tree search if its list has
+ * a sorted tree and a walk if it doesn't.
+ * @param m Map to query.
+ * @param key Key to look for in the map.
+ * @param h Hash of the key.
+ * @param link Filled in, if not null, with the link findLink returns for
+ *             a list that was walked, or null for a sorted list.
+ * @return Node* the node with the given key, or null.
+ */
+static Node *findNode( Map *m, VType *key, unsigned int h, Node ***link )
+{
+  int i = h % m->tlen;
+  if ( m->sorted && m->sorted[ i ] ) {
+    if ( link )
+      *link = NULL;
+    return sortedFind( m->sorted[ i ], key, h );
+  }
+
+  Node **l = findLink( m, key, h );
+  if ( link )
+    *link = l;
+  return *l;
+}
+
+/**
+ * Look for the given key, consulting the Bloom filter first if there is
+ * one.  This is findNode, except it can skip the search entirely.
+ * @param m Map to query.
+ * @param key Key to look for in the map.
+ * @param h Hash of the key.
+ * @param link Filled in, if not null, as by findNode, or with null if
+ *             the filter rules the key out.
+ * @return Node* the node with the given key, or null.
+ */
+static Node *lookupNode( Map *m, VType *key, unsigned int h, Node ***link )
+{
+  //a negative from the filter means the key can't be in its list
+  if ( m->bloom ) {
+    m->bloomStats.queries++;
+    if ( !bloomMayContain( m->bloom, h ) ) {
+      m->bloomStats.negatives++;
+      if ( link )
+        *link = NULL;
+      return NULL;
+    }
+  }
+
+  Node *n = findNode( m, key, h, link );
+
+  //the filter let a missing key through
+  if ( m->bloom && !n )
+    m->bloomStats.falsePositives++;
+
+  return n;
+}
+
+/**
+ * Search the map for given key and return the NODE with the given key.
+ * If the key does not exist in the map, return null.
+ * @param m Map to query.
+ * @param key Key to look for in the map.
+ * @return Node* Node associated with the given key.
+ *               Null if the key does not exist in the map.
+ */
+static Node *mapSearch( Map *m, VType *key )
+{
+  return lookupNode( m, key, key->hash( key ), NULL );
+}
+
+/**
+ * Find the position of a key in the map's dense array.
+ * @param d Dense array of the map.
+ * @param key Key to look for.
+ * @return int index of the key in the array, or -1 if it isn't an
+ * Integer in the array's range.
+ */
+static int denseIndex( DenseArray *d, VType const *key )
+{
+  if ( !isInteger( key ) )
+    return -1;
+  long long i = (long long) ( (Integer const *) key )->val - d->lo;
+  return i >= 0 && i < d->len ? (int) i : -1;
+}
+
+/**
+ * Report whether a key in the map's dense array is in the map.
+ * @param d Dense array of the map.
+ * @param i Index of the key in the array.
+ * @return bool true if the key has a value.
+ */
+static bool denseHas( DenseArray *d, int i )
+{
+  return d->occupied[ i / DENSE_WORD_BITS ] >> ( i % DENSE_WORD_BITS ) & 1;
+}
+
+/**
+ * Move a map out of dense mode, putting every key and value in its
+ * table.  Anything that needs nodes calls this first.
+ * @param m Map to move out of dense mode.
+ */
+static void leaveDense( Map *m )
+{
+  DenseArray *d = m->dense;
+  if ( !d )
+    return;
+
+  //the keys weren't kept, so make new ones
+  m->dense = NULL;
+  int count = m->size;
+  m->size = 0;
+  mapReserve( m, count );
+  for ( int i = 0; i < d->len; i++ )
+    if ( denseHas( d, i ) )
+      mapSet( m, makeInteger( d->lo + i ), d->vals[ i ] );
+
+  free( d->vals );
+  free( d->occupied );
+  free( d );
+}
+
+/**
+ * Move a key and value out of a cuckoo table and into the map's nodes.
+ * @param key Key to move.
+ * @param val Value to move.
+ * @param data The map.
+ */
+static void moveEntry( VType *key, VType *val, void *data )
+{
+  mapSet( (Map *) data, key, val );
+}
+
+/**
+ * Move a map out of cuckoo mode, putting every key and value in its
+ * table of lists.  Anything that needs nodes calls this first.
+ * @param m Map to move out of cuckoo mode.
+ */
+static void leaveCuckoo( Map *m )
+{
+  Cuckoo *c = m->cuckoo;
+  if ( !c )
+    return;
+
+  m->cuckoo = NULL;
+  int count = m->size;
+  m->size = 0;
+  mapReserve( m, count );
+  cuckooForEach( c, moveEntry, m );
+  freeCuckoo( c );
+}
+
+/**
+ * Look up a key whose hash is already known, in a map that isn't in
+ * dense mode.
+ * @param m Map to look in.
+ * @param key Key to look for.
+ * @param h Hash of the key.
+ * @return VType* the key's value, or null if it isn't in the map.
+ */
+static VType *getHashed( Map *m, VType *key, unsigned int h )
+{
+  if ( m->cuckoo ) {
+    VType **slot = cuckooFind( m->cuckoo, key, h );
+    return slot ? *slot : NULL;
+  }
+
+  //try the hot-key cache before walking the key's list
+  Node **cached = NULL;
+  if ( m->cache ) {
+    m->cacheStats.lookups++;
+    cached = &m->cache[ h & ( CACHE_SLOTS - 1 ) ];
+    if ( *cached && (*cached)->hash == h && key->equals( key, (*cached)->key ) ) {
+      m->cacheStats.hits++;
+      return (*cached)->val;
+    }
+  }
+
+  //find the Node in the map with the given key
+  Node *keyNode = lookupNode( m, key, h, NULL );
+
+  //remember it for next time
+  if ( cached && keyNode )
+    *cached = keyNode;
+
+  //if the node exists, return its value
+  if ( keyNode )
+    return keyNode->val;
+
+  //if not, return null
+  else
+    return NULL;
+}
+
+VType *mapGet( Map *m, VType *key )
+{
+  //in dense mode, the key is the index of its value
+  if ( m->dense ) {
+    int i = denseIndex( m->dense, key );
+    return i >= 0 && denseHas( m->dense, i ) ? m->dense->vals[ i ] : NULL;
+  }
+
+  return getHashed( m, key, key->hash( key ) );
+}
+
+/**
+ * Frees all the memory used by the node n.
+ * @param n the node in question.
+ */
+static void freeNode( Node *n )
+{
+  if ( !n->keyInline && n->key->print )
+    n->key->destroy( n->key );
+  if ( !valIsInline( n ) && n->val->print )
+    n->val->destroy( n->val );
+  free( n );
+}
+
+/**
+ * Frees a node that's been removed from the map, and its key and value,
+ * or retires the key and value if a snapshot might still be using them.
+ * @param m Map the node was removed from.
+ * @param n Node to free.
+ */
+static void releaseNode( Map *m, Node *n )
+{
+  if ( !m->snapshots ) {
+    freeNode( n );
+    return;
+  }
+
+  //anything stored in the node is the map's own copy, since the node's
+  //list was copied before it changed
+  if ( !n->keyInline )
+    releaseVType( m, n->key );
+  if ( !valIsInline( n ) )
+    releaseVType( m, n->val );
+  free( n );
+}
+
+/**
+ * Find the node for a key, adding one if the key is new.  This is
+ * mapEntry for a map that isn't in dense mode, except it can take the
+ * value for a new key, so the value can be stored in the node.
+ * @param m Map to look in.
+ * @param key Key to find, owned by the map if it's added.
+ * @param val Value for the key if it's new, or null to leave it unset.
+ * @param h Hash of the key.
+ * @param inserted Set to true if the key was added.
+ * @return Node* the node for the key.
+ */
+static Node *entryNode( Map *m, VType *key, VType *val, unsigned int h,
+                        bool *inserted )
+{
+  //find the key, or the end of its list, in a single walk
+  Node **link;
+  Node *found = lookupNode( m, key, h, &link );
+
+  //a list shared with a snapshot is copied before it changes
+  if ( m->snapshots && unshareBucket( m, h % m->tlen ) && ( found || link ) )
+    found = findNode( m, key, h, &link );
+
+  //if the node exists, hand it back
+  if( found ) {
+    *inserted = false;
+    return found;
+  }
+
+  // //EXTRA CREDIT: resize the map if the number of entries is equal to the number of the length of the hash table
+  //after a resize, or if the filter or a sorted tree skipped the walk,
+  //the new node just goes at the front of its list
+  if ( m->size == m->tlen ) {
+    resizeTable( m, m->tlen * 2 );
+    link = NULL;
+  }
+  if ( !link )
+    link = &m->table[ h % m->tlen ];
+
+  //create the new node and link it in where the walk stopped, or in hash
+  //order if its list has a tree
+  Node *newNode = makeNode( m, key, val, h );
+  key = newNode->key;
+  linkNode( m, h % m->tlen, link, newNode );
+  m->size++;
+
+  if ( m->bloom )
+    bloomAdd( m->bloom, h );
+
+  //keep the ordered index up to date with new Integer keys
+  if ( m->index && isInteger( key ) )
+    skipListInsert( m->index, ( (Integer *) key )->val );
+
+  //copies in the node already have a string of their own, right beside it
+  if ( m->pool && !newNode->keyInline )
+    textIntern( m->pool, key );
+  if ( m->pool && val && !newNode->valInline )
+    textIntern( m->pool, val );
+
+  *inserted = true;
+  return newNode;
+}
+
+/**
+ * Find the value slot for a key in a cuckoo map, adding the key if it's
+ * new.
+ * @param m Map to look in, in cuckoo mode.
+ * @param key Key to find, owned by the map if it's added.
+ * @param h Hash of the key.
+ * @param inserted Set to true if the key was added.
+ * @return VType** the key's value slot.
+ */
+static VType **cuckooEntry( Map *m, VType *key, unsigned int h, bool *inserted )
+{
+  //a key the cuckoo table doesn't have gets a slot in it, wherever
+  //there's room
+  VType **slot = cuckooFind( m->cuckoo, key, h );
+  *inserted = !slot;
+  if ( slot )
+    return slot;
+
+  m->size++;
+  if ( m->pool )
+    textIntern( m->pool, key );
+  return cuckooInsert( m->cuckoo, key, h );
+}
+
+VType **mapEntry( Map *m, VType *key, bool *inserted )
+{
+  //a key in the dense range just marks its slot, and isn't kept
+  if ( m->dense ) {
+    DenseArray *d = m->dense;
+    int i = denseIndex( d, key );
+    if ( i >= 0 ) {
+      *inserted = !denseHas( d, i );
+      if ( *inserted ) {
+        d->occupied[ i / DENSE_WORD_BITS ] |= 1ull << ( i % DENSE_WORD_BITS );
+        d->vals[ i ] = NULL;
+        m->size++;
+        key->destroy( key );
+      }
+      return &d->vals[ i ];
+    }
+
+    //any other key needs the table
+    leaveDense( m );
+  }
+
+  unsigned int h = key->hash( key );
+  if ( m->cuckoo )
+    return cuckooEntry( m, key, h, inserted );
+
+  return &entryNode( m, key, NULL, h, inserted )->val;
+}
+
+/**
+ * Store a value in the slot a dense or cuckoo map found for its key.
+ * @param m Map the slot belongs to.
+ * @param slot The key's value slot.
+ * @param inserted True if the key was just added, so the map owns it.
+ * @param key Key the value is for, freed if the map already had it.
+ * @param value Value to store.
+ */
+static void setSlot( Map *m, VType **slot, bool inserted, VType *key, VType *value )
+{
+  if ( !inserted ) {
+    key->destroy( key );
+    releaseVType( m, *slot );
+  }
+  if ( m->pool )
+    textIntern( m->pool, value );
+  *slot = value;
+}
+
+/**
+ * Set the value for a key whose hash is already known, in a map that
+ * isn't in dense mode.
+ * @param m Map to set the value in.
+ * @param key Key to set, owned by the map from here on.
+ * @param value Value for the key, owned by the map from here on.
+ * @param h Hash of the key.
+ */
+static void setHashed( Map *m, VType *key, VType *value, unsigned int h )
+{
+  bool inserted;
+
+  //cuckoo maps keep their values in slots rather than in nodes
+  if ( m->cuckoo ) {
+    VType **slot = cuckooEntry( m, key, h, &inserted );
+    setSlot( m, slot, inserted, key, value );
+    return;
+  }
+
+  //a new key gets its value as it's added
+  Node *n = entryNode( m, key, value, h, &inserted );
+  if ( inserted )
+    return;
+
+  //if the key was already there, keep its key
+  key->destroy( key );
+
+  //an Integer replacing one stored in the node is copied over it
+  if ( valIsInline( n ) && isInteger( n->val ) && isInteger( value ) ) {
+    ( (Integer *) n->val )->val = ( (Integer *) value )->val;
+    value->destroy( value );
+    return;
+  }
+
+  //otherwise free the old value and point to the new one
+  if ( !valIsInline( n ) )
+    releaseVType( m, n->val );
+  if ( m->pool )
+    textIntern( m->pool, value );
+  n->val = value;
+}
+
+void mapSet( Map *m, VType *key, VType *value )
+{
+  //a key in the dense range goes in its slot
+  if ( m->dense && denseIndex( m->dense, key ) >= 0 ) {
+    bool inserted;
+    VType **slot = mapEntry( m, key, &inserted );
+    setSlot( m, slot, inserted, key, value );
+    return;
+  }
+  leaveDense( m );
+
+  setHashed( m, key, value, key->hash( key ) );
+}
+
+/**
+ * Remove the key-value pair with the given key, without shrinking the table.
+ * @param m Map to remove from.
+ * @param key Key to remove from the map.
+ * @param h Hash of the key, unused in dense mode.
+ * @return true if the key was in the map and was removed.
+ */
+static bool removeKey( Map *m, VType *key, unsigned int h )
+{
+  if ( m->dense ) {
+    DenseArray *d = m->dense;
+    int i = denseIndex( d, key );
+    if ( i < 0 || !denseHas( d, i ) )
+      return false;
+    d->occupied[ i / DENSE_WORD_BITS ] &= ~( 1ull << ( i % DENSE_WORD_BITS ) );
+    m->size--;
+    d->vals[ i ]->destroy( d->vals[ i ] );
+    return true;
+  }
+
+  if ( m->cuckoo ) {
+    VType *val;
+    VType *found = cuckooRemove( m->cuckoo, key, h, &val );
+    if ( !found )
+      return false;
+    m->size--;
+    found->destroy( found );
+    val->destroy( val );
+    return true;
+  }
+
+  //find the node with the given key
+  Node **link;
+  Node *oldNode = lookupNode( m, key, h, &link );
+
+  //if the key does not exist in the map, return false
+  if( !oldNode )
+    return false;
+
+  //a list shared with a snapshot is copied before it changes
+  if ( m->snapshots && unshareBucket( m, h % m->tlen ) )
+    oldNode = findNode( m, key, h, &link );
+
+  //unlink the node and free it
+  unlinkNode( m, h % m->tlen, link, oldNode );
+  m->size--;
+  uncacheNode( m, oldNode );
+
+  if ( m->bloom )
+    bloomRemove( m->bloom, oldNode->hash );
+
+  //drop the key from the ordered index
+  if ( m->index && isInteger( key ) )
+    skipListRemove( m->index, ( (Integer *) key )->val );
+
+  releaseNode( m, oldNode );
+  return true;
+}
+
+/**
+ * Give memory back once the table is mostly empty.
+ * @param m Map that keys were just removed from.
+ */
+static void shrinkIfSparse( Map *m )
+{
+  if ( m->tlen > m->minLen && m->size < m->tlen / SHRINK_LOAD ) {
+    int newTLen = m->tlen / 2;
+    resizeTable( m, newTLen > m->minLen ? newTLen : m->minLen );
+  }
+}
+
+bool mapRemove( Map *m, VType *key )
+{
+  if ( !removeKey( m, key, m->dense ? 0 : key->hash( key ) ) )
+    return false;
+
+  shrinkIfSparse( m );
+
+  //return true indicating that the key-value pair was removed
+  return true;
+}
+
+/**
+ * Hash a group of keys at once, so Text keys go through the batch kernel.
+ * @param keys Keys to hash.
+ * @param n Number of keys.
+ * @return unsigned int* the hash of each key, for the caller to free.
+ */
+static unsigned int *hashGroup( VType **keys, int n )
+{
+  unsigned int *hashes = (unsigned int *) malloc( n * sizeof( unsigned int ) );
+  textHashBatch( keys, n, hashes );
+  return hashes;
+}
+
+void mapGetAll( Map *m, VType **keys, int n, VType **vals )
+{
+  //dense lookups don't hash
+  if ( m->dense ) {
+    for ( int i = 0; i < n; i++ )
+      vals[ i ] = mapGet( m, keys[ i ] );
+    return;
+  }
+
+  unsigned int *hashes = hashGroup( keys, n );
+  for ( int i = 0; i < n; i++ )
+    vals[ i ] = getHashed( m, keys[ i ], hashes[ i ] );
+  free( hashes );
+}
+
+void mapSetAll( Map *m, VType **keys, VType **vals, int n )
+{
+  //make room for the whole group up front, doubling as many times as
+  //the group needs, so it resizes at most once
+  if ( m->cuckoo )
+    cuckooReserve( m->cuckoo, m->size + n );
+  else if ( !m->dense && m->size + n > m->tlen ) {
+    int newTLen = m->tlen;
+    while ( newTLen < m->size + n )
+      newTLen *= 2;
+    resizeTable( m, newTLen );
+  }
+
+  //a map in dense mode only leaves it one key at a time
+  if ( m->dense ) {
+    for ( int i = 0; i < n; i++ )
+      mapSet( m, keys[ i ], vals[ i ] );
+    return;
+  }
+
+  unsigned int *hashes = hashGroup( keys, n );
+  for ( int i = 0; i < n; i++ )
+    setHashed( m, keys[ i ], vals[ i ], hashes[ i ] );
+  free( hashes );
+}
+
+int mapRemoveAll( Map *m, VType **keys, int n )
+{
+  int removed = 0;
+  unsigned int *hashes = m->dense ? NULL : hashGroup( keys, n );
+  for ( int i = 0; i < n; i++ )
+    if ( removeKey( m, keys[ i ], hashes ? hashes[ i ] : 0 ) )
+      removed++;
+  free( hashes );
+
+  //shrink at most once, after the whole group
+  shrinkIfSparse( m );
+  return removed;
+}
+
+void mapEnableIndex( Map *m )
+{
+  if ( m->index )
+    return;
+  leaveDense( m );
+  leaveCuckoo( m );
+
+  //index every Integer key that's already in the map
+  m->index = makeSkipList();
+  for( int i = 0; i < m->tlen; i++ )
+    for( Node *current = m->table[ i ]; current; current = current->next )
+      if ( isInteger( current->key ) )
+        skipListInsert( m->index, ( (Integer *) current->key )->val );
+}
+
+/**
+ * Visit function for the ordered index during a range query. Looks up
+ * the node for the given key and reports it to the caller's visit function.
+ * @param key Integer key found in the index.
+ * @param data The RangeQuery in progress.
+ */
+static void visitIndexKey( int key, void *data )
+{
+  RangeQuery *query = (RangeQuery *) data;
+
+  //look up the node with a temporary key on the stack
+  Integer k;
+  initInteger( &k, key );
+  Node *keyNode = mapSearch( query->map, (VType *) &k );
+
+  query->visit( keyNode->key, keyNode->val, query->data );
+}
+
+int mapRange( Map *m, int lo, int hi,
+              void (*visit)( VType const *key, VType *val, void *data ),
+              void *data )
+{
+  //a dense map is already in key order, so just scan its bitmap
+  if ( m->dense ) {
+    DenseArray *d = m->dense;
+    long long first = (long long) lo - d->lo;
+    long long last = (long long) hi - d->lo;
+    if ( first < 0 )
+      first = 0;
+    if ( last >= d->len )
+      last = d->len - 1;
+
+    int count = 0;
+    Integer k;
+    for ( long long i = first; i <= last; i++ ) {
+      //skip whole words with no keys in them
+      unsigned long long word = d->occupied[ i / DENSE_WORD_BITS ] >> ( i % DENSE_WORD_BITS );
+      if ( !word ) {
+        i |= DENSE_WORD_BITS - 1;
+        continue;
+      }
+      i += __builtin_ctzll( word );
+      if ( i > last )
+        break;
+      initInteger( &k, d->lo + i );
+      visit( (VType *) &k, d->vals[ i ], data );
+      count++;
+    }
+    return count;
+  }
+
+  mapEnableIndex( m );
+
+  RangeQuery query = { m, visit, data };
+  return skipListRange( m->index, lo, hi, visitIndexKey, &query );
+}
+
+/**
+ * Visit function for the cuckoo table during mapForEach.  Passes the pair
+ * on to the caller's visit function.
+ * @param key Key of the pair.
+ * @param val Value of the pair.
+ * @param data The RangeQuery in progress.
+ */
+static void visitCuckooEntry( VType *key, VType *val, void *data )
+{
+  RangeQuery *query = (RangeQuery *) data;
+  query->visit( key, val, query->data );
+}
+
+int mapForEach( Map *m, void (*visit)( VType const *key, VType *val, void *data ),
+                void *data )
+{
+  //a dense map's keys are all in the range of ints
+  if ( m->dense )
+    return mapRange( m, INT_MIN, INT_MAX, visit, data );
+
+  if ( m->cuckoo ) {
+    RangeQuery query = { m, visit, data };
+    cuckooForEach( m->cuckoo, visitCuckooEntry, &query );
+    return m->size;
+  }
+
+  for ( int i = 0; i < m->tlen; i++ )
+    for ( Node *current = m->table[ i ]; current; current = current->next )
+      visit( current->key, current->val, data );
+  return m->size;
+}
+
+void mapEnableBloom( Map *m )
+{
+  if ( m->bloom )
+    return;
+  leaveDense( m );
+  leaveCuckoo( m );
+
+  //add every key that's already in the map
+  m->bloom = makeBloom( m->tlen );
+  for( int i = 0; i < m->tlen; i++ )
+    for( Node *current = m->table[ i ]; current; current = current->next )
+      bloomAdd( m->bloom, current->hash );
+
+  m->bloomStats = (MapBloomStats) { 0, 0, 0 };
+}
+
+void mapBloomStats( Map *m, MapBloomStats *stats )
+{
+  *stats = m->bloomStats;
+}
+
+void mapEnableHugeTable( Map *m )
+{
+  if ( m->hugeTable )
+    return;
+
+  //move the nodes into a mapped table now, if it's big enough for one
+  m->hugeTable = true;
+  if ( (size_t) m->tlen * sizeof( Node * ) >= HUGE_PAGE_SIZE )
+    resizeTable( m, m->tlen );
+}
+
+void mapEnableCache( Map *m )
+{
+  if ( m->cache )
+    return;
+  leaveDense( m );
+  leaveCuckoo( m );
+
+  m->cache = (Node **) calloc( CACHE_SLOTS, sizeof( Node * ) );
+  m->cacheStats = (MapCacheStats) { 0, 0 };
+}
+
+void mapCacheStats( Map *m, MapCacheStats *stats )
+{
+  *stats = m->cacheStats;
+}
+
+void mapEnableInline( Map *m )
+{
+  m->inlineEntries = true;
+}
+
+bool mapEnableDense( Map *m, int lo, int hi )
+{
+  long long len = (long long) hi - lo + 1;
+  if ( m->dense || m->cuckoo || m->size > 0 || len < 1 ||
+       len > INT_MAX - DENSE_WORD_BITS || m->index || m->bloom || m->cache ||
+       m->snapshots )
+    return false;
+
+  DenseArray *d = (DenseArray *) malloc( sizeof( DenseArray ) );
+  d->lo = lo;
+  d->len = len;
+  d->vals = (VType **) malloc( len * sizeof( VType * ) );
+  d->occupied = (unsigned long long *)
+    calloc( ( len + DENSE_WORD_BITS - 1 ) / DENSE_WORD_BITS, sizeof( unsigned long long ) );
+  m->dense = d;
+  return true;
+}
+
+bool mapEnableCuckoo( Map *m )
+{
+  if ( m->dense || m->cuckoo || m->size > 0 || m->index || m->bloom || m->cache ||
+       m->snapshots )
+    return false;
+
+  m->cuckoo = makeCuckoo( m->tlen );
+  return true;
+}
+
+/**
+ * Intern a key and value from a cuckoo table.
+ * @param key Key to intern.
+ * @param val Value to intern.
+ * @param data The map's pool.
+ */
+static void internEntry( VType *key, VType *val, void *data )
+{
+  textIntern( (TextPool *) data, key );
+  textIntern( (TextPool *) data, val );
+}
+
+void mapEnableIntern( Map *m )
+{
+  if ( m->pool )
+    return;
+
+  //intern every Text that's already in the map
+  m->pool = makeTextPool();
+  if ( m->dense )
+    for ( int i = 0; i < m->dense->len; i++ )
+      if ( denseHas( m->dense, i ) )
+        textIntern( m->pool, m->dense->vals[ i ] );
+  if ( m->cuckoo )
+    cuckooForEach( m->cuckoo, internEntry, m->pool );
+  for( int i = 0; i < m->tlen; i++ )
+    for( Node *current = m->table[ i ]; current; current = current->next ) {
+      if ( !current->keyInline )
+        textIntern( m->pool, current->key );
+      if ( !valIsInline( current ) )
+        textIntern( m->pool, current->val );
+    }
+}
+
+MapSnapshot *mapSnapshot( Map *m )
+{
+  //snapshots share nodes, so the map needs some
+  leaveDense( m );
+  leaveCuckoo( m );
+
+  //the first snapshot starts tracking which lists are shared
+  if ( !m->bucketGen )
+    m->bucketGen = (unsigned int *) calloc( m->tlen, sizeof( unsigned int ) );
+
+  //the snapshot shares every list the map has right now
+  MapSnapshot *s = (MapSnapshot *) malloc( sizeof( MapSnapshot ) );
+  s->map = m;
+  s->tlen = m->tlen;
+  s->size = m->size;
+  s->table = (Node **) malloc( s->tlen * sizeof( Node * ) );
+  memcpy( s->table, m->table, s->tlen * sizeof( Node * ) );
+  s->gen = ++m->gen;
+
+  s->next = m->snapshots;
+  m->snapshots = s;
+  return s;
+}
+
+int snapshotSize( MapSnapshot *s )
+{
+  return s->size;
+}
+
+VType *snapshotGet( MapSnapshot *s, VType *key )
+{
+  unsigned int h = key->hash( key );
+  for ( Node *current = s->table[ h % s->tlen ]; current; current = current->next )
+    if ( current->hash == h && key->equals( key, current->key ) )
+      return current->val;
+  return NULL;
+}
+
+int snapshotForEach( MapSnapshot *s,
+                     void (*visit)( VType const *key, VType *val, void *data ),
+                     void *data )
+{
+  for ( int i = 0; i < s->tlen; i++ )
+    for ( Node *current = s->table[ i ]; current; current = current->next )
+      visit( current->key, current->val, data );
+  return s->size;
+}
+
+void freeSnapshot( MapSnapshot *s )
+{
+  Map *m = s->map;
+
+  //take the snapshot out of the map's list
+  MapSnapshot **link = &m->snapshots;
+  while ( *link != s )
+    link = &(*link)->next;
+  *link = s->next;
+  free( s->table );
+  free( s );
+
+  //anything retired before the oldest remaining snapshot was taken
+  //isn't used by any snapshot now
+  MapSnapshot *oldest = m->snapshots;
+  while ( oldest && oldest->next )
+    oldest = oldest->next;
+
+  Retired **rlink = &m->retired;
+  while ( *rlink ) {
+    Retired *r = *rlink;
+    if ( oldest && r->gen >= oldest->gen ) {
+      rlink = &r->next;
+      continue;
+    }
+
+    *rlink = r->next;
+    if ( r->vtype )
+      r->vtype->destroy( r->vtype );
+    while ( r->chain ) {
+      Node *nextNode = r->chain->next;
+      free( r->chain );
+      r->chain = nextNode;
+    }
+    free( r );
+  }
+
+  //with no snapshots left, the map goes back to not tracking sharing
+  if ( !m->snapshots ) {
+    free( m->bucketGen );
+    m->bucketGen = NULL;
+  }
+}
+
+/**
+ * Free a key and value from a cuckoo table.
+ * @param key Key to free.
+ * @param val Value to free.
+ * @param data Unused.
+ */
+static void destroyEntry( VType *key, VType *val, void *data )
+{
+  key->destroy( key );
+  val->destroy( val );
+}
+
+void freeMap( Map *m )
+{
+  //free every node in the map's hashtable
+  for( int i = 0; i < m->tlen; i++ ) {
+
+    //get the first node in the linked list
+    Node *current = m->table[ i ];
+
+    //while current is not null, remove it
+    while( current ) {
+      Node *nextNode = current->next;
+      freeNode( current );
+      current = nextNode;
+    }
+
+  }
+
+  //free the values of a dense map
+  if ( m->dense ) {
+    for ( int i = 0; i < m->dense->len; i++ )
+      if ( denseHas( m->dense, i ) )
+        m->dense->vals[ i ]->destroy( m->dense->vals[ i ] );
+    free( m->dense->vals );
+    free( m->dense->occupied );
+    free( m->dense );
+  }
+
+  //free the keys and values of a cuckoo map
+  if ( m->cuckoo ) {
+    cuckooForEach( m->cuckoo, destroyEntry, NULL );
+    freeCuckoo( m->cuckoo );
+  }
+
+  //free the table, its sorted trees and the ordered index
+  freeTable( m );
+  freeSorted( m );
+  if ( m->index )
+    freeSkipList( m->index );
+  if ( m->bloom )
+    freeBloom( m->bloom );
+
+  free( m->cache );
+
+  //every interned Text is gone, so the pool can go too
+  if ( m->pool )
+    freeTextPool( m->pool );
 
   //finally, free the map
   free( m );
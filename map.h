@@ -13,7 +13,33 @@
 /** Incomplete type for the Map representation. */
 typedef struct MapStruct Map;
 
-/** Make an empty map.
+/** Incomplete type for a read-only snapshot of a map. */
+typedef struct MapSnapshotStruct MapSnapshot;
+
+/** Counts of Bloom filter results for a map, for measuring how well the
+    filter is working. */
+typedef struct {
+  /** Number of lookups that consulted the filter. */
+  long queries;
+
+  /** Number of lookups the filter answered by itself, key not present. */
+  long negatives;
+
+  /** Number of lookups the filter let through for keys not present. */
+  long falsePositives;
+} MapBloomStats;
+
+/** Counts of hot-key cache results for a map. */
+typedef struct {
+  /** Number of lookups that checked the cache. */
+  long lookups;
+
+  /** Number of lookups the cache answered without walking a list. */
+  long hits;
+} MapCacheStats;
+
+/** Make an empty map.  The table grows as keys are added and shrinks
+    back toward its initial length as they are removed.
     @param len Initial length of the hash table.
     @return pointer to a new map.
 */
@@ -23,6 +49,29 @@ Map *makeMap( int len );
     @param m Pointer to the map.
     @return Number of key/value pairs in the map. */
 int mapSize( Map *m );
+
+/** Get the current length of the map's hash table.
+    @param m Pointer to the map.
+    @return Number of elements in the map's table, or of slots in its
+    buckets in cuckoo mode. */
+int mapCapacity( Map *m );
+
+/**
+ * Grow the table so the map can hold at least n keys without resizing.
+ * Bulk loads can call this first to skip every intermediate doubling.
+ * @param m Pointer to the map.
+ * @param n Number of keys to make room for.
+ */
+void mapReserve( Map *m, int n );
+
+/**
+ * Shrink the table to fit the keys currently in the map, leaving it
+ * half full.  This can go below the map's initial length.  In cuckoo
+ * mode, the cuckoo table shrinks to the fewest buckets that hold the
+ * keys instead.
+ * @param m Pointer to the map.
+ */
+void mapCompact( Map *m );
   
 /** Return the value associated with the given key. The returned VType
     is still owned by the map.
@@ -42,6 +91,23 @@ VType *mapGet( Map *m, VType *key );
  */
 void mapSet( Map *m, VType *key, VType *value );
 
+/**
+ * Find the value slot for the given key, adding the key to the map if
+ * it isn't there yet.  This takes a single walk of the key's list, so
+ * read-modify-write updates like counters can change a value in place.
+ * If the key was added, the map takes ownership of it and the returned
+ * slot is null; the caller must fill it in before using the map again.
+ * Otherwise, the map keeps its own copy of the key and the caller still
+ * owns the one it passed in.  While the map has snapshots, an existing
+ * value may be shared with them, so it must not be changed in place or
+ * freed; use mapSet to replace it instead.
+ * @param m Pointer to the map.
+ * @param key Key to find or add.
+ * @param inserted Set to true if the key was added to the map.
+ * @return Pointer to the value slot for the key, owned by the map.
+ */
+VType **mapEntry( Map *m, VType *key, bool *inserted );
+
 /**
  * Removes the key-value pair in the map with the given key.
  * @param m Pointer to the map.
@@ -51,8 +117,219 @@ void mapSet( Map *m, VType *key, VType *value );
  */
 bool mapRemove( Map *m, VType *key );
 
+/**
+ * Look up a group of keys in one pass.
+ * @param m Map to query.
+ * @param keys Keys to look for in the map.
+ * @param n Number of keys.
+ * @param vals Filled in with the value for each key, or NULL for keys
+ *             that aren't in the map.  These are still owned by the map.
+ */
+void mapGetAll( Map *m, VType **keys, int n, VType **vals );
+
+/**
+ * Set a group of key-value pairs in one pass, as if by calling mapSet on
+ * each in order.  The table is resized at most once for the whole group.
+ * @param m Pointer to the map.
+ * @param keys Keys to set in the map.
+ * @param vals Value for each key.
+ * @param n Number of key-value pairs.
+ */
+void mapSetAll( Map *m, VType **keys, VType **vals, int n );
+
+/**
+ * Remove a group of keys in one pass.  The table is shrunk at most once
+ * for the whole group.
+ * @param m Pointer to the map.
+ * @param keys Keys to remove from the map.  These still belong to the caller.
+ * @param n Number of keys.
+ * @return Number of keys that were in the map and were removed.
+ */
+int mapRemoveAll( Map *m, VType **keys, int n );
+
+/**
+ * Start maintaining an ordered index over the map's Integer keys, so
+ * range queries don't have to probe every value in the range. The index
+ * is off by default, and maps that never enable it pay nothing for it.
+ * Enabling it on a map that already has an index has no effect.
+ * @param m Pointer to the map.
+ */
+void mapEnableIndex( Map *m );
+
+/**
+ * Call the given function on every key/value pair with an Integer key
+ * in the closed range [lo, hi], in ascending key order. This enables the
+ * ordered index on the first call if it isn't enabled already. The
+ * function must not modify the map.
+ * @param m Pointer to the map.
+ * @param lo Smallest key to visit.
+ * @param hi Largest key to visit.
+ * @param visit Function called with each key and its value.
+ * @param data Passed through to every call of visit.
+ * @return Number of key/value pairs visited.
+ */
+int mapRange( Map *m, int lo, int hi,
+              void (*visit)( VType const *key, VType *val, void *data ),
+              void *data );
+
+/**
+ * Call the given function on every key/value pair in the map, in no
+ * particular order, without changing the map's mode.  The keys of a
+ * dense map are temporary Integers that only last for the call.  The
+ * function must not modify the map.
+ * @param m Pointer to the map.
+ * @param visit Function called with each key and its value.
+ * @param data Passed through to every call of visit.
+ * @return Number of key/value pairs visited.
+ */
+int mapForEach( Map *m, void (*visit)( VType const *key, VType *val, void *data ),
+                void *data );
+
+/**
+ * Put a counting Bloom filter in front of the map's table, so lookups
+ * and removals of missing keys can usually skip walking a list.  The
+ * filter is off by default.  Enabling it on a map that already has a
+ * filter has no effect.
+ * @param m Pointer to the map.
+ */
+void mapEnableBloom( Map *m );
+
+/**
+ * Report how the map's Bloom filter has done since it was enabled.  The
+ * false positive rate is falsePositives / ( negatives + falsePositives ).
+ * @param m Pointer to the map.
+ * @param stats Filled in with the filter's counts.
+ */
+void mapBloomStats( Map *m, MapBloomStats *stats );
+
+/**
+ * Map the table straight from the kernel with huge pages once it's at
+ * least a huge page in size, instead of allocating it with calloc.  This
+ * cuts TLB misses on very large tables, and a shrinking table gives its
+ * pages back to the kernel.  Where mmap isn't available this has no
+ * effect.  Enabling it again has no effect either.
+ * @param m Pointer to the map.
+ */
+void mapEnableHugeTable( Map *m );
+
+/**
+ * Put a small direct-mapped cache of recently found keys in front of
+ * mapGet, so repeated lookups of the same few keys skip walking their
+ * lists.  The cache is off by default.  Enabling it on a map that
+ * already has one has no effect.
+ * @param m Pointer to the map.
+ */
+void mapEnableCache( Map *m );
+
+/**
+ * Report how the map's hot-key cache has done since it was enabled.
+ * The hit rate is hits / lookups.
+ * @param m Pointer to the map.
+ * @param stats Filled in with the cache's counts.
+ */
+void mapCacheStats( Map *m, MapCacheStats *stats );
+
+/**
+ * Store each new key and value in the same allocation as its node, when
+ * they're Integers or Texts, with a Text's string right after it.  Then a
+ * lookup finds the key it compares, and the value it returns, in the
+ * node it's already reading, instead of following pointers to separate
+ * allocations.  Entries made earlier keep pointing to their key and value.
+ * The map copies a key or value it stores this way and destroys the
+ * original, so the caller can't keep using a key or value it hands to
+ * mapSet or a key it hands to mapEntry.
+ * @param m Pointer to the map.
+ */
+void mapEnableInline( Map *m );
+
+/**
+ * Store the values of an empty map in an array indexed by Integer key,
+ * for keys that are mostly contiguous, like IDs in a known range.  In
+ * dense mode a lookup is an array load, with no hashing or equals calls,
+ * and the map keeps no key objects or nodes: a key is destroyed as soon
+ * as it's added.  The first key outside [lo, hi], or that isn't an
+ * Integer, moves everything into the hash table for good, as does taking
+ * a snapshot or enabling the index, Bloom filter or hot-key cache.
+ * @param m Pointer to the map.
+ * @param lo Smallest key the array covers.
+ * @param hi Largest key the array covers.
+ * @return true if the map is now in dense mode, false if it isn't empty,
+ * is in cuckoo mode, the range is empty or too large, or it has one of
+ * those features.
+ */
+bool mapEnableDense( Map *m, int lo, int hi );
+
+/**
+ * Keep the keys and values of an empty map in a bucketized cuckoo table
+ * instead of lists, for tables where the slowest lookups matter more
+ * than the average.  Each key lives in one of two buckets of four slots,
+ * each bucket a single cache line, or in a small stash, so a lookup
+ * checks at most eight slots and the stash however the keys hash.
+ * Inserting may move other keys to make room, so a slot from mapEntry
+ * is only good until the map next changes.  Taking a snapshot or
+ * enabling the index, Bloom filter or hot-key cache moves everything
+ * into lists for good.
+ * @param m Pointer to the map.
+ * @return true if the map is now in cuckoo mode, false if it isn't
+ * empty, is in dense mode or has one of those features.
+ */
+bool mapEnableCuckoo( Map *m );
+
+/**
+ * Start interning the map's Text keys and values, so each different
+ * string is stored once however many keys and values repeat it, and
+ * Text keys compare by pointer.  Texts are interned as mapEntry inserts
+ * keys and mapSet stores values; a value stored through a slot from
+ * mapEntry keeps its own copy.  Enabling it again has no effect.
+ * @param m Pointer to the map.
+ */
+void mapEnableIntern( Map *m );
+
+/**
+ * Take a read-only, point-in-time view of the map.  The map can keep
+ * changing while the snapshot is in use.  Taking a snapshot copies the
+ * table of list heads but no nodes, keys or values.  After that, the first
+ * change to each list gives the map its own copy of that list's nodes.
+ * Keys and values the map drops are kept until every snapshot that could
+ * see them is freed.
+ * @param m Pointer to the map.
+ * @return Pointer to the new snapshot.
+ */
+MapSnapshot *mapSnapshot( Map *m );
+
+/** Get the size of a snapshot.
+    @param s Pointer to the snapshot.
+    @return Number of key/value pairs in the map when the snapshot was taken. */
+int snapshotSize( MapSnapshot *s );
+
+/** Return the value a key had when the snapshot was taken.  The returned
+    VType is still owned by the map and must not be changed.
+    @param s Snapshot to query.
+    @param key Key to look for in the snapshot.
+    @return Value associated with the given key, or NULL if the key
+    wasn't in the map.
+*/
+VType *snapshotGet( MapSnapshot *s, VType *key );
+
+/**
+ * Call the given function on every key/value pair in a snapshot, in no
+ * particular order.
+ * @param s Pointer to the snapshot.
+ * @param visit Function called with each key and its value.
+ * @param data Passed through to every call of visit.
+ * @return Number of key/value pairs visited.
+ */
+int snapshotForEach( MapSnapshot *s,
+                     void (*visit)( VType const *key, VType *val, void *data ),
+                     void *data );
+
+/** Free a snapshot, along with anything the map kept only for it.
+    @param s The snapshot to free.
+*/
+void freeSnapshot( MapSnapshot *s );
+
 /** Free all the memory used to store a map, including all the
-    memory in its key/value pairs.
+    memory in its key/value pairs.  Free its snapshots first.
     @param m The map to free.
 */
 void freeMap( Map *m );
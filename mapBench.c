@@ -0,0 +1,201 @@
+// Benchmark for the map's memory layout, comparing a calloc'd table with
+// one mapped on huge pages, and nodes that point to their keys and values
+// with nodes that hold them inline.  Page faults and data TLB misses are
+// counted with perf_event_open, where the kernel allows it.
+
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <linux/perf_event.h>
+
+#include "vtype.h"
+#include "map.h"
+#include "integer.h"
+
+/** Default number of keys to put in the map. */
+#define DEFAULT_KEYS ( 1 << 21 )
+
+/** Number of table elements reserved per key, so the table dominates. */
+#define BUCKETS_PER_KEY 8
+
+/** Number of random lookups to time. */
+#define LOOKUPS ( 1 << 23 )
+
+/** Ways of laying out the map that the benchmark compares. */
+typedef enum {
+  /** Table from calloc, keys and values allocated apart from the nodes. */
+  MODE_CALLOC,
+
+  /** Table mapped on huge pages. */
+  MODE_HUGE,
+
+  /** Table from calloc, keys and values stored in the nodes. */
+  MODE_INLINE,
+
+  /** Number of modes. */
+  MODE_COUNT
+} Mode;
+
+/** Name of each mode, for reports. */
+static char const *modeNames[ MODE_COUNT ] = { "calloc", "huge", "inline" };
+
+/** Counters measured for each phase. */
+typedef struct {
+  /** Descriptor for counting page faults, or -1 if unavailable. */
+  int faults;
+
+  /** Descriptor for counting data TLB load misses, or -1 if unavailable. */
+  int tlbMisses;
+
+  /** Clock reading when the phase started. */
+  clock_t start;
+} Counters;
+
+/**
+ * Open a counter for this process, disabled until the phase starts.
+ * @param type Kind of event, hardware, software or cache.
+ * @param config Which event of that kind.
+ * @return int file descriptor for the counter, or -1 if it can't be opened.
+ */
+static int openCounter( unsigned int type, unsigned long long config )
+{
+  struct perf_event_attr attr;
+  memset( &attr, 0, sizeof( attr ) );
+  attr.size = sizeof( attr );
+  attr.type = type;
+  attr.config = config;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return syscall( SYS_perf_event_open, &attr, 0, -1, -1, 0 );
+}
+
+/**
+ * Reset and start the counters for a phase.
+ * @param c Counters to start.
+ */
+static void startPhase( Counters *c )
+{
+  int fds[] = { c->faults, c->tlbMisses };
+  for ( int i = 0; i < 2; i++ )
+    if ( fds[ i ] >= 0 ) {
+      ioctl( fds[ i ], PERF_EVENT_IOC_RESET, 0 );
+      ioctl( fds[ i ], PERF_EVENT_IOC_ENABLE, 0 );
+    }
+  c->start = clock();
+}
+
+/**
+ * Print one counter's reading, or n/a if it isn't available.
+ * @param fd Counter to read.
+ */
+static void printCounter( int fd )
+{
+  long long count;
+  if ( fd >= 0 && read( fd, &count, sizeof( count ) ) == sizeof( count ) )
+    printf( " %14lld", count );
+  else
+    printf( " %14s", "n/a" );
+}
+
+/**
+ * Stop the counters for a phase and report them.
+ * @param c Counters to stop.
+ * @param name Name of the phase.
+ */
+static void endPhase( Counters *c, char const *name )
+{
+  double secs = (double) ( clock() - c->start ) / CLOCKS_PER_SEC;
+  if ( c->faults >= 0 )
+    ioctl( c->faults, PERF_EVENT_IOC_DISABLE, 0 );
+  if ( c->tlbMisses >= 0 )
+    ioctl( c->tlbMisses, PERF_EVENT_IOC_DISABLE, 0 );
+
+  printf( "%-14s %9.3f s", name, secs );
+  printCounter( c->faults );
+  printCounter( c->tlbMisses );
+  printf( "\n" );
+}
+
+/**
+ * Fill a map and look up random keys in it, reporting each phase.  This
+ * runs in its own process, so each mode starts with a fresh heap.
+ * @param mode How to lay out the map.
+ * @param keys Number of keys to put in the map.
+ */
+static void run( Mode mode, int keys )
+{
+  Counters c;
+  c.faults = openCounter( PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS );
+  c.tlbMisses = openCounter( PERF_TYPE_HW_CACHE,
+                             PERF_COUNT_HW_CACHE_DTLB |
+                             ( PERF_COUNT_HW_CACHE_OP_READ << 8 ) |
+                             ( PERF_COUNT_HW_CACHE_RESULT_MISS << 16 ) );
+  char name[ 32 ];
+
+  //the table is reserved up front, so building it is where it's touched
+  snprintf( name, sizeof( name ), "%s build", modeNames[ mode ] );
+  startPhase( &c );
+  Map *m = makeMap( 1 );
+  if ( mode == MODE_HUGE )
+    mapEnableHugeTable( m );
+  if ( mode == MODE_INLINE )
+    mapEnableInline( m );
+  mapReserve( m, keys * BUCKETS_PER_KEY );
+  for ( int i = 0; i < keys; i++ )
+    mapSet( m, makeInteger( i * BUCKETS_PER_KEY ), makeInteger( i ) );
+  endPhase( &c, name );
+
+  //random lookups, so consecutive probes land on different pages
+  snprintf( name, sizeof( name ), "%s lookup", modeNames[ mode ] );
+  unsigned int seed = 0x9E3779B9u;
+  long check = 0;
+  Integer key;
+  startPhase( &c );
+  for ( int i = 0; i < LOOKUPS; i++ ) {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    initInteger( &key, ( seed % keys ) * BUCKETS_PER_KEY );
+    check += ( (Integer *) mapGet( m, (VType *) &key ) )->val;
+  }
+  endPhase( &c, name );
+
+  freeMap( m );
+  if ( check < 0 )
+    printf( "unexpected check %ld\n", check );
+
+  if ( c.faults >= 0 )
+    close( c.faults );
+  if ( c.tlbMisses >= 0 )
+    close( c.tlbMisses );
+}
+
+int main( int argc, char *argv[] )
+{
+  int keys = argc > 1 ? atoi( argv[ 1 ] ) : DEFAULT_KEYS;
+  if ( keys <= 0 ) {
+    fprintf( stderr, "usage: mapBench [keys]\n" );
+    return EXIT_FAILURE;
+  }
+
+  printf( "%d keys, %d table elements\n", keys, keys * BUCKETS_PER_KEY );
+  printf( "%-14s %11s %14s %14s\n", "phase", "time", "page faults", "dTLB misses" );
+  fflush( stdout );
+  for ( int mode = 0; mode < MODE_COUNT; mode++ ) {
+    if ( fork() == 0 ) {
+      run( mode, keys );
+      exit( EXIT_SUCCESS );
+    }
+    wait( NULL );
+  }
+
+  return EXIT_SUCCESS;
+}
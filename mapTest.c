@@ -4,10 +4,46 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
 
 #include "vtype.h"
 #include "map.h"
 #include "integer.h"
+#include "text.h"
+#include "frozen.h"
+#include "shmmap.h"
+#include "typedmap.h"
+
+/** Hash function for the specialized int map, the same one Integer uses. */
+static unsigned int hashInt( int k )
+{
+  return k;
+}
+
+/** Equality function for the specialized int map. */
+static bool equalsInt( int a, int b )
+{
+  return a == b;
+}
+
+MAP_DEFINE( IntIntMap, int, int, hashInt, equalsInt )
+
+/** Visit function for range queries that adds up the Integer keys it sees,
+    checking that they arrive in ascending order. */
+static void sumKeys( VType const *key, VType *val, void *data )
+{
+  int *sum = (int *) data;
+  int k = ( (Integer const *) key )->val;
+  assert( k * 10 > *sum );
+  *sum = k * 10;
+}
+
+/** Visit function for snapshots that adds up the Integer values it sees. */
+static void addValues( VType const *key, VType *val, void *data )
+{
+  *(int *) data += ( (Integer *) val )->val;
+}
 
 int main()
 {
@@ -30,6 +66,509 @@ int main()
   mapSet( map, v7, v8 );
   assert( mapSize( map ) == 4 );
   assert( v1->equals( v2, mapGet( map, v1 ) ) );
+
+  //test range queries over the ordered index
+  Map *ordered = makeMap( 4 );
+  for ( int i = 20; i > 0; i-- ) {
+    char buf[ 12 ];
+    sprintf( buf, "%d", i * 3 );
+    mapSet( ordered, parseInteger( buf, NULL ), parseInteger( buf, NULL ) );
+  }
+  int last = 0;
+  assert( mapRange( ordered, 10, 30, sumKeys, &last ) == 7 );
+  assert( last == 300 );
+  assert( mapRemove( ordered, v3 ) );
+  last = 0;
+  assert( mapRange( ordered, 0, 10, sumKeys, &last ) == 2 );
+  assert( last == 90 );
+  assert( mapRange( ordered, 61, 100, sumKeys, &last ) == 0 );
+  freeMap( ordered );
+
+  //test reserving, automatic shrinking and compaction
+  Map *churn = makeMap( 8 );
+  mapReserve( churn, 1000 );
+  assert( mapCapacity( churn ) == 1000 );
+  for ( int i = 0; i < 1000; i++ ) {
+    char buf[ 12 ];
+    sprintf( buf, "%d", i );
+    mapSet( churn, parseInteger( buf, NULL ), parseInteger( buf, NULL ) );
+  }
+  assert( mapCapacity( churn ) == 1000 );
+  for ( int i = 0; i < 990; i++ ) {
+    char buf[ 12 ];
+    sprintf( buf, "%d", i );
+    VType *k = parseInteger( buf, NULL );
+    assert( mapRemove( churn, k ) );
+    k->destroy( k );
+  }
+  assert( mapSize( churn ) == 10 );
+  assert( mapCapacity( churn ) < 100 && mapCapacity( churn ) >= 8 );
+  mapCompact( churn );
+  assert( mapCapacity( churn ) == 20 );
+  VType *k995 = parseInteger( "995", NULL );
+  assert( v1->equals( k995, mapGet( churn, k995 ) ) );
+  k995->destroy( k995 );
+  freeMap( churn );
+
+  //test updating values in place through mapEntry
+  Map *counts = makeMap( 2 );
+  bool inserted;
+  VType **slot = mapEntry( counts, parseInteger( "9", NULL ), &inserted );
+  assert( inserted && *slot == NULL );
+  *slot = parseInteger( "1", NULL );
+  VType *k9 = parseInteger( "9", NULL );
+  slot = mapEntry( counts, k9, &inserted );
+  assert( !inserted && v1->equals( v1, *slot ) );
+  ( (Integer *) *slot )->val += 4;
+  assert( v5->equals( v5, mapGet( counts, k9 ) ) );
+  mapSet( counts, parseInteger( "9", NULL ), parseInteger( "8", NULL ) );
+  assert( mapSize( counts ) == 1 );
+  assert( v8->equals( v8, mapGet( counts, k9 ) ) );
+  k9->destroy( k9 );
+  freeMap( counts );
+
+  //test a Bloom filter in front of the table, across resizes
+  Map *filtered = makeMap( 16 );
+  mapSet( filtered, parseInteger( "-1", NULL ), parseInteger( "1", NULL ) );
+  mapEnableBloom( filtered );
+  for ( int i = 0; i < 2000; i += 2 )
+    mapSet( filtered, makeInteger( i ), makeInteger( i ) );
+  for ( int i = 0; i < 1000; i += 4 ) {
+    Integer k;
+    initInteger( &k, i );
+    assert( mapRemove( filtered, (VType *) &k ) );
+  }
+  for ( int i = -1; i < 2000; i++ ) {
+    Integer k;
+    initInteger( &k, i );
+    bool present = i == -1 || ( i % 2 == 0 && ( i >= 1000 || i % 4 != 0 ) );
+    assert( ( mapGet( filtered, (VType *) &k ) != NULL ) == present );
+  }
+  MapBloomStats stats;
+  mapBloomStats( filtered, &stats );
+  assert( stats.negatives > 0 );
+  assert( stats.falsePositives * 10 < stats.negatives + stats.falsePositives );
+  freeMap( filtered );
+
+  //test snapshots staying the same while the map changes
+  Map *live = makeMap( 4 );
+  for ( int i = 0; i < 4; i++ )
+    mapSet( live, makeInteger( i ), makeInteger( i * 10 ) );
+  MapSnapshot *before = mapSnapshot( live );
+  mapSet( live, makeInteger( 1 ), makeInteger( 11 ) );
+  Integer k1, k2;
+  initInteger( &k1, 1 );
+  initInteger( &k2, 2 );
+  assert( mapRemove( live, (VType *) &k2 ) );
+  for ( int i = 100; i < 120; i++ )
+    mapSet( live, makeInteger( i ), makeInteger( i ) );
+  MapSnapshot *after = mapSnapshot( live );
+  mapSet( live, makeInteger( 1 ), makeInteger( 12 ) );
+  assert( snapshotSize( before ) == 4 && snapshotSize( after ) == 23 );
+  assert( ( (Integer *) snapshotGet( before, (VType *) &k1 ) )->val == 10 );
+  assert( ( (Integer *) snapshotGet( before, (VType *) &k2 ) )->val == 20 );
+  assert( ( (Integer *) snapshotGet( after, (VType *) &k1 ) )->val == 11 );
+  assert( snapshotGet( after, (VType *) &k2 ) == NULL );
+  freeSnapshot( before );
+  assert( ( (Integer *) snapshotGet( after, (VType *) &k1 ) )->val == 11 );
+  assert( ( (Integer *) mapGet( live, (VType *) &k1 ) )->val == 12 );
+  int sum = 0;
+  assert( snapshotForEach( after, addValues, &sum ) == 23 );
+  assert( sum == 0 + 11 + 30 + 2190 );
+  freeSnapshot( after );
+  mapSet( live, makeInteger( 1 ), makeInteger( 13 ) );
+  assert( mapRemove( live, (VType *) &k1 ) );
+  freeMap( live );
+
+  //test setting, getting and removing keys as a group
+  Map *group = makeMap( 4 );
+  VType *gkeys[ 40 ], *gvals[ 40 ];
+  for ( int i = 0; i < 40; i++ ) {
+    gkeys[ i ] = makeInteger( i );
+    gvals[ i ] = makeInteger( i * 2 );
+  }
+  mapSetAll( group, gkeys, gvals, 40 );
+  assert( mapSize( group ) == 40 && mapCapacity( group ) == 64 );
+  Integer probes[ 3 ];
+  VType *pkeys[ 3 ], *pvals[ 3 ];
+  for ( int i = 0; i < 3; i++ ) {
+    initInteger( &probes[ i ], i * 30 );
+    pkeys[ i ] = (VType *) &probes[ i ];
+  }
+  mapGetAll( group, pkeys, 3, pvals );
+  assert( ( (Integer *) pvals[ 0 ] )->val == 0 );
+  assert( ( (Integer *) pvals[ 1 ] )->val == 60 );
+  assert( pvals[ 2 ] == NULL );
+  assert( mapRemoveAll( group, pkeys, 3 ) == 2 );
+  assert( mapSize( group ) == 38 );
+  freeMap( group );
+
+  //Text keys in a group are hashed together, and must land where single
+  //lookups find them
+  Map *words = makeMap( 4 );
+  VType *wkeys[ 20 ], *wvals[ 20 ];
+  char word[ 32 ];
+  for ( int i = 0; i < 20; i++ ) {
+    sprintf( word, "word %d%s", i, i % 3 ? "" : " with a longer tail" );
+    wkeys[ i ] = makeText( word );
+    wvals[ i ] = makeInteger( i );
+  }
+  mapSetAll( words, wkeys, wvals, 20 );
+  for ( int i = 0; i < 20; i++ ) {
+    sprintf( word, "word %d%s", i, i % 3 ? "" : " with a longer tail" );
+    wkeys[ i ] = makeText( word );
+    assert( ( (Integer *) mapGet( words, wkeys[ i ] ) )->val == i );
+  }
+  mapGetAll( words, wkeys, 20, wvals );
+  for ( int i = 0; i < 20; i++ )
+    assert( ( (Integer *) wvals[ i ] )->val == i );
+  assert( mapRemoveAll( words, wkeys, 20 ) == 20 && mapSize( words ) == 0 );
+  for ( int i = 0; i < 20; i++ )
+    wkeys[ i ]->destroy( wkeys[ i ] );
+  freeMap( words );
+
+  //test a table mapped on huge pages through growing and shrinking
+  Map *big = makeMap( 1 );
+  mapEnableHugeTable( big );
+  mapReserve( big, 1 << 19 );
+  for ( int i = 0; i < 1000; i++ )
+    mapSet( big, makeInteger( i ), makeInteger( -i ) );
+  Integer bk;
+  initInteger( &bk, 999 );
+  assert( ( (Integer *) mapGet( big, (VType *) &bk ) )->val == -999 );
+  mapCompact( big );
+  assert( mapCapacity( big ) == 2000 );
+  assert( ( (Integer *) mapGet( big, (VType *) &bk ) )->val == -999 );
+  freeMap( big );
+
+  //test dense mode, then leaving it for a key outside the range
+  Map *dense = makeMap( 8 );
+  assert( mapEnableDense( dense, 100, 1099 ) );
+  assert( !mapEnableDense( dense, 0, 10 ) );
+  for ( int i = 100; i < 1100; i += 2 )
+    mapSet( dense, makeInteger( i ), makeInteger( -i ) );
+  mapSet( dense, makeInteger( 100 ), makeInteger( 7 ) );
+  Integer dk;
+  initInteger( &dk, 100 );
+  assert( ( (Integer *) mapGet( dense, (VType *) &dk ) )->val == 7 );
+  initInteger( &dk, 101 );
+  assert( mapGet( dense, (VType *) &dk ) == NULL && !mapRemove( dense, (VType *) &dk ) );
+  initInteger( &dk, 1098 );
+  assert( mapRemove( dense, (VType *) &dk ) && mapSize( dense ) == 499 );
+  int denseSum = 0;
+  assert( mapRange( dense, 0, 200, sumKeys, &denseSum ) == 51 && denseSum == 2000 );
+  mapSet( dense, makeText( "outside" ), makeInteger( 1 ) );
+  assert( mapSize( dense ) == 500 );
+  initInteger( &dk, 1096 );
+  assert( ( (Integer *) mapGet( dense, (VType *) &dk ) )->val == -1096 );
+  freeMap( dense );
+
+  //test keys and values stored in their nodes, through a snapshot
+  Map *packed = makeMap( 4 );
+  mapEnableInline( packed );
+  mapEnableIntern( packed );
+  for ( int i = 0; i < 100; i++ )
+    mapSet( packed, makeInteger( i ), makeInteger( i ) );
+  mapSet( packed, makeText( "name" ), makeText( "packed" ) );
+  MapSnapshot *earlier = mapSnapshot( packed );
+  for ( int i = 0; i < 100; i++ )
+    mapSet( packed, makeInteger( i ), makeInteger( i * 2 ) );
+  VType *name = makeText( "name" );
+  slot = mapEntry( packed, name, &inserted );
+  assert( !inserted );
+  *slot = makeInteger( 5 );
+  initInteger( &bk, 40 );
+  assert( mapRemove( packed, (VType *) &bk ) && mapSize( packed ) == 100 );
+  initInteger( &bk, 7 );
+  assert( ( (Integer *) snapshotGet( earlier, (VType *) &bk ) )->val == 7 );
+  assert( ( (Integer *) mapGet( packed, (VType *) &bk ) )->val == 14 );
+  Text *old = (Text *) snapshotGet( earlier, name );
+  assert( old && strcmp( old->str, "packed" ) == 0 && snapshotSize( earlier ) == 101 );
+  freeSnapshot( earlier );
+  assert( ( (Integer *) mapGet( packed, name ) )->val == 5 );
+  assert( mapRemove( packed, name ) );
+  int packedSum = 0;
+  earlier = mapSnapshot( packed );
+  snapshotForEach( earlier, addValues, &packedSum );
+  assert( packedSum == 9900 - 80 );
+  freeSnapshot( earlier );
+  name->destroy( name );
+  freeMap( packed );
+
+  //test a cuckoo table with keys that would crowd one list, then moving
+  //it into lists for a snapshot
+  Map *cuckoo = makeMap( 8 );
+  assert( mapEnableCuckoo( cuckoo ) && !mapEnableCuckoo( cuckoo ) );
+  assert( !mapEnableDense( cuckoo, 0, 10 ) );
+  for ( int i = 0; i < 3000; i++ )
+    mapSet( cuckoo, makeInteger( i * 1024 ), makeInteger( i ) );
+  mapSet( cuckoo, makeText( "name" ), makeInteger( -1 ) );
+  mapSet( cuckoo, makeInteger( 0 ), makeInteger( 7 ) );
+  Integer ck;
+  initInteger( &ck, 2999 * 1024 );
+  assert( ( (Integer *) mapGet( cuckoo, (VType *) &ck ) )->val == 2999 );
+  initInteger( &ck, 1024 + 1 );
+  assert( mapGet( cuckoo, (VType *) &ck ) == NULL && !mapRemove( cuckoo, (VType *) &ck ) );
+  for ( int i = 1; i < 1000; i++ ) {
+    initInteger( &ck, i * 1024 );
+    assert( mapRemove( cuckoo, (VType *) &ck ) );
+  }
+  slot = mapEntry( cuckoo, makeInteger( 1024 ), &inserted );
+  assert( inserted && *slot == NULL );
+  *slot = makeInteger( 1 );
+  assert( mapSize( cuckoo ) == 2003 );
+  MapSnapshot *listed = mapSnapshot( cuckoo );
+  int cuckooSum = 0;
+  assert( snapshotForEach( listed, addValues, &cuckooSum ) == 2003 );
+  assert( cuckooSum == 7 + 1 - 1 + ( 1000 + 2999 ) * 2000 / 2 );
+  freeSnapshot( listed );
+  assert( ( (Integer *) mapGet( cuckoo, name = makeText( "name" ) ) )->val == -1 );
+  name->destroy( name );
+  freeMap( cuckoo );
+
+  //test that a cuckoo map reports and compacts its own table
+  Map *packedCuckoo = makeMap( 8 );
+  mapEnableCuckoo( packedCuckoo );
+  for ( int i = 0; i < 1000; i++ )
+    mapSet( packedCuckoo, makeInteger( i ), makeInteger( i ) );
+  assert( mapCapacity( packedCuckoo ) >= 1000 );
+  for ( int i = 100; i < 1000; i++ ) {
+    initInteger( &ck, i );
+    assert( mapRemove( packedCuckoo, (VType *) &ck ) );
+  }
+  mapCompact( packedCuckoo );
+  assert( mapCapacity( packedCuckoo ) == 128 );
+  for ( int i = 0; i < 100; i++ ) {
+    initInteger( &ck, i );
+    assert( ( (Integer *) mapGet( packedCuckoo, (VType *) &ck ) )->val == i );
+  }
+  freeMap( packedCuckoo );
+
+  //test keys that all land in one list, which gets a sorted array
+  Map *skewed = makeMap( 64 );
+  for ( int i = 0; i < 500; i++ )
+    mapSet( skewed, makeInteger( i * 1024 ), makeInteger( i ) );
+  assert( mapCapacity( skewed ) == 512 );
+  Integer sk;
+  initInteger( &sk, 499 * 1024 );
+  assert( ( (Integer *) mapGet( skewed, (VType *) &sk ) )->val == 499 );
+  initInteger( &sk, 1024 + 512 );
+  assert( mapGet( skewed, (VType *) &sk ) == NULL );
+  MapSnapshot *flat = mapSnapshot( skewed );
+  for ( int i = 0; i < 495; i++ ) {
+    initInteger( &sk, i * 1024 );
+    assert( mapRemove( skewed, (VType *) &sk ) );
+    assert( !mapRemove( skewed, (VType *) &sk ) );
+  }
+  mapSet( skewed, makeInteger( 0 ), makeInteger( -1 ) );
+  assert( mapSize( skewed ) == 6 && snapshotSize( flat ) == 500 );
+  for ( int i = 495; i < 500; i++ ) {
+    initInteger( &sk, i * 1024 );
+    assert( ( (Integer *) mapGet( skewed, (VType *) &sk ) )->val == i );
+  }
+  initInteger( &sk, 7 * 1024 );
+  assert( ( (Integer *) snapshotGet( flat, (VType *) &sk ) )->val == 7 );
+  freeSnapshot( flat );
+  freeMap( skewed );
+
+  //test removing from the middle of a long list, out of order and with
+  //keys added back along the way
+  Map *chain = makeMap( 64 );
+  for ( int i = 0; i < 300; i++ )
+    mapSet( chain, makeInteger( i * 1024 ), makeInteger( i ) );
+  for ( int i = 0; i < 250; i++ ) {
+    initInteger( &sk, i * 7 % 300 * 1024 );
+    assert( mapRemove( chain, (VType *) &sk ) );
+    if ( i % 10 == 0 ) {
+      mapSet( chain, makeInteger( i * 7 % 300 * 1024 ), makeInteger( -1 ) );
+      assert( mapRemove( chain, (VType *) &sk ) );
+    }
+  }
+  assert( mapSize( chain ) == 50 );
+  for ( int i = 0; i < 300; i++ ) {
+    initInteger( &sk, i * 1024 );
+    Integer *got = (Integer *) mapGet( chain, (VType *) &sk );
+    assert( i * 43 % 300 < 250 ? got == NULL : got->val == i );
+  }
+  for ( int i = 0; i < 300; i++ ) {
+    initInteger( &sk, i * 1024 );
+    assert( mapRemove( chain, (VType *) &sk ) == ( i * 43 % 300 >= 250 ) );
+  }
+  assert( mapSize( chain ) == 0 );
+  freeMap( chain );
+
+  //test the hot-key cache stays coherent through changes and snapshots
+  Map *hot = makeMap( 2 );
+  mapEnableCache( hot );
+  for ( int i = 0; i < 50; i++ )
+    mapSet( hot, makeInteger( i ), makeInteger( i ) );
+  Integer hk;
+  initInteger( &hk, 7 );
+  assert( ( (Integer *) mapGet( hot, (VType *) &hk ) )->val == 7 );
+  assert( ( (Integer *) mapGet( hot, (VType *) &hk ) )->val == 7 );
+  mapSet( hot, makeInteger( 7 ), makeInteger( 70 ) );
+  assert( ( (Integer *) mapGet( hot, (VType *) &hk ) )->val == 70 );
+  MapSnapshot *cold = mapSnapshot( hot );
+  mapSet( hot, makeInteger( 7 ), makeInteger( 700 ) );
+  assert( ( (Integer *) mapGet( hot, (VType *) &hk ) )->val == 700 );
+  assert( ( (Integer *) snapshotGet( cold, (VType *) &hk ) )->val == 70 );
+  freeSnapshot( cold );
+  assert( mapRemove( hot, (VType *) &hk ) );
+  assert( mapGet( hot, (VType *) &hk ) == NULL );
+  MapCacheStats cacheStats;
+  mapCacheStats( hot, &cacheStats );
+  assert( cacheStats.lookups == 5 && cacheStats.hits == 2 );
+  freeMap( hot );
+
+  //test interning repeated Text keys and values
+  Map *interned = makeMap( 4 );
+  mapSet( interned, parseText( "\"a\"", NULL ), parseText( "\"on\"", NULL ) );
+  mapEnableIntern( interned );
+  mapSet( interned, parseText( "\"b\"", NULL ), parseText( "\"on\"", NULL ) );
+  mapSet( interned, makeInteger( 3 ), parseText( "\"b\"", NULL ) );
+  VType *ka = parseText( "\"a\"", NULL );
+  VType *kb = parseText( "\"b\"", NULL );
+  Text *va = (Text *) mapGet( interned, ka );
+  Text *vb = (Text *) mapGet( interned, kb );
+  assert( va->str == vb->str && strcmp( va->str, "on" ) == 0 );
+  assert( mapRemove( interned, ka ) && mapGet( interned, ka ) == NULL );
+  assert( strcmp( vb->str, "on" ) == 0 );
+  ka->destroy( ka );
+  kb->destroy( kb );
+  freeMap( interned );
+
+  //test freezing a map into an image and looking keys up in it
+  Map *source = makeMap( 16 );
+  for ( int i = 0; i < 3000; i++ ) {
+    char buf[ 32 ];
+    sprintf( buf, "\"v%d\"", i );
+    mapSet( source, makeInteger( i * 3 ), parseText( buf, NULL ) );
+  }
+  mapSet( source, parseText( "\"name\"", NULL ), makeInteger( -5 ) );
+  assert( mapFreeze( source, "mapTest.frozen" ) );
+  freeMap( source );
+  FrozenMap *frozen = mapOpenFrozen( "mapTest.frozen" );
+  assert( frozen && frozenSize( frozen ) == 3001 );
+  FrozenValue fv;
+  Integer fk;
+  for ( int i = 0; i < 9000; i++ ) {
+    initInteger( &fk, i );
+    VType *v = frozenGet( frozen, (VType *) &fk, &fv );
+    if ( i % 3 ) {
+      assert( v == NULL );
+      continue;
+    }
+    char buf[ 32 ];
+    sprintf( buf, "v%d", i / 3 );
+    assert( v && isText( v ) && strcmp( ( (Text *) v )->str, buf ) == 0 );
+  }
+  VType *fname = parseText( "\"name\"", NULL );
+  VType *fmissing = parseText( "\"nam\"", NULL );
+  assert( ( (Integer *) frozenGet( frozen, fname, &fv ) )->val == -5 );
+  assert( frozenGet( frozen, fmissing, &fv ) == NULL );
+  fname->destroy( fname );
+  fmissing->destroy( fmissing );
+  freeFrozenMap( frozen );
+
+  //dense and cuckoo maps are frozen in place, and keep working after
+  Map *denseSource = makeMap( 4 );
+  Map *cuckooSource = makeMap( 4 );
+  assert( mapEnableDense( denseSource, 0, 99 ) && mapEnableCuckoo( cuckooSource ) );
+  for ( int i = 0; i < 100; i += 2 ) {
+    mapSet( denseSource, makeInteger( i ), makeInteger( -i ) );
+    mapSet( cuckooSource, makeInteger( i ), makeInteger( -i ) );
+  }
+  for ( int pass = 0; pass < 2; pass++ ) {
+    Map *source = pass ? cuckooSource : denseSource;
+    assert( mapFreeze( source, "mapTest.frozen" ) );
+    frozen = mapOpenFrozen( "mapTest.frozen" );
+    assert( frozen && frozenSize( frozen ) == 50 );
+    for ( int i = 0; i < 100; i++ ) {
+      initInteger( &fk, i );
+      VType *v = frozenGet( frozen, (VType *) &fk, &fv );
+      assert( i % 2 ? v == NULL : ( (Integer *) v )->val == -i );
+      v = mapGet( source, (VType *) &fk );
+      assert( i % 2 ? v == NULL : ( (Integer *) v )->val == -i );
+    }
+    freeFrozenMap( frozen );
+    freeMap( source );
+  }
+  Map *none = makeMap( 1 );
+  assert( mapFreeze( none, "mapTest.frozen" ) );
+  freeMap( none );
+  frozen = mapOpenFrozen( "mapTest.frozen" );
+  assert( frozen && frozenSize( frozen ) == 0 );
+  assert( frozenGet( frozen, (VType *) &fk, &fv ) == NULL );
+  freeFrozenMap( frozen );
+  remove( "mapTest.frozen" );
+  assert( mapOpenFrozen( "mapTest.frozen" ) == NULL );
+
+  //test a shared map, written here and read by another process
+  char shmName[ 32 ];
+  sprintf( shmName, "/mapTest-%d", (int) getpid() );
+  SharedMap *shared = makeSharedMap( shmName, 64, 1 << 16 );
+  assert( shared && makeSharedMap( shmName, 64, 1 << 16 ) == NULL );
+  for ( int i = 0; i < 200; i++ ) {
+    Integer sk, sv;
+    initInteger( &sk, i );
+    initInteger( &sv, i * i );
+    assert( sharedMapSet( shared, (VType *) &sk, (VType *) &sv ) );
+  }
+  VType *sname = parseText( "\"name\"", NULL );
+  VType *sval = parseText( "\"short\"", NULL );
+  assert( sharedMapSet( shared, sname, sval ) );
+  sval->destroy( sval );
+  sval = parseText( "\"a value too long to fit in the old block\"", NULL );
+  assert( sharedMapSet( shared, sname, sval ) );
+  assert( sharedMapSize( shared ) == 201 );
+  pid_t reader = fork();
+  if ( reader == 0 ) {
+    //the reader attaches by name and sees everything the writer set
+    SharedMap *view = openSharedMap( shmName );
+    bool good = view && sharedMapSize( view ) == 201;
+    for ( int i = 0; good && i < 200; i++ ) {
+      Integer sk;
+      initInteger( &sk, i );
+      VType *v = sharedMapGet( view, (VType *) &sk );
+      good = v && ( (Integer *) v )->val == i * i;
+      if ( v )
+        v->destroy( v );
+    }
+    VType *v = good ? sharedMapGet( view, sname ) : NULL;
+    good = v && v->equals( v, sval );
+    if ( v )
+      v->destroy( v );
+    freeSharedMap( view );
+    exit( good ? EXIT_SUCCESS : EXIT_FAILURE );
+  }
+  int status;
+  assert( waitpid( reader, &status, 0 ) == reader );
+  assert( WIFEXITED( status ) && WEXITSTATUS( status ) == EXIT_SUCCESS );
+  assert( sharedMapRemove( shared, sname ) && !sharedMapRemove( shared, sname ) );
+  assert( sharedMapGet( shared, sname ) == NULL && sharedMapSize( shared ) == 200 );
+  assert( !sharedMapSet( shared, sname, (VType *) &(Integer){ 0 } ) );
+  sname->destroy( sname );
+  sval->destroy( sval );
+  freeSharedMap( shared );
+  assert( unlinkSharedMap( shmName ) && openSharedMap( shmName ) == NULL );
+
+  //test a map specialized to int keys and values
+  IntIntMap *ints = makeIntIntMap( 2 );
+  for ( int i = 0; i < 100; i++ )
+    IntIntMapSet( ints, i * 7, i );
+  assert( IntIntMapSize( ints ) == 100 );
+  assert( *IntIntMapGet( ints, 70 ) == 10 );
+  assert( IntIntMapGet( ints, 71 ) == NULL );
+  *IntIntMapEntry( ints, 70, &inserted ) += 5;
+  assert( !inserted && *IntIntMapGet( ints, 70 ) == 15 );
+  for ( int i = 0; i < 95; i++ )
+    assert( IntIntMapRemove( ints, i * 7 ) );
+  assert( !IntIntMapRemove( ints, 0 ) );
+  assert( IntIntMapSize( ints ) == 5 && IntIntMapCapacity( ints ) < 100 );
+  IntIntMapCompact( ints );
+  assert( IntIntMapCapacity( ints ) == 10 );
+  assert( *IntIntMapGet( ints, 98 * 7 ) == 98 );
+  freeIntIntMap( ints );
   
   
   // VType *v5 = parseInteger( "5", NULL );
@@ -0,0 +1,429 @@
+/**
+    @file replay.c
+    @author
+    Read-ahead line reader for command logs.  The file is read in fixed
+    blocks, a few at a time, into a ring of buffers; as soon as the caller
+    is done with a block, its buffer goes back to the kernel for the block
+    that's READ_AHEAD further on.  The io_uring rings are set up with the
+    raw system calls, so there's no library to link.
+*/
+
+// mmap's MAP_POPULATE and syscall aren't part of C99.
+#define _DEFAULT_SOURCE
+
+#include "replay.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/** Size of each block read from the file. */
+#define REPLAY_BLOCK ( 64 * 1024 )
+
+/** Number of blocks read at once, and of buffers for them. */
+#define READ_AHEAD 4
+
+/** Initial capacity of a line, doubled as needed. */
+#define INITIAL_LINE_CAPACITY 64
+
+/** A process's view of an io_uring instance. */
+typedef struct {
+  /** File descriptor for the instance. */
+  int fd;
+
+  /** Submission queue ring, shared with the kernel. */
+  void *sqRing;
+
+  /** Size of the submission queue ring mapping. */
+  size_t sqRingSize;
+
+  /** Completion queue ring, which may be the same mapping. */
+  void *cqRing;
+
+  /** Size of the completion queue ring mapping. */
+  size_t cqRingSize;
+
+  /** Submission queue entries. */
+  struct io_uring_sqe *sqes;
+
+  /** Size of the submission queue entry mapping. */
+  size_t sqesSize;
+
+  /** Fields of the submission queue ring. */
+  unsigned int *sqTail, *sqMask, *sqArray;
+
+  /** Fields of the completion queue ring. */
+  unsigned int *cqHead, *cqTail, *cqMask;
+
+  /** Completion queue entries, in the completion ring. */
+  struct io_uring_cqe *cqes;
+} Ring;
+
+/** Representation of an open command log. */
+struct ReplayStruct {
+  /** Descriptor of the file. */
+  int fd;
+
+  /** Size of the file when it was opened. */
+  long long size;
+
+  /** Ring the reads go through, or null to read with pread. */
+  Ring *ring;
+
+  /** Buffer for each block in flight; block k uses buffer k % READ_AHEAD. */
+  char *buf[ READ_AHEAD ];
+
+  /** Number of bytes read into each buffer so far. */
+  int filled[ READ_AHEAD ];
+
+  /** True while a read into the buffer is in flight. */
+  bool busy[ READ_AHEAD ];
+
+  /** Number of the block being consumed, or -1 before the first. */
+  long long block;
+
+  /** Position of the next unread byte in the current block. */
+  int pos;
+
+  /** Number of bytes in the current block. */
+  int len;
+
+  /** True once a read has failed. */
+  bool failed;
+};
+
+/**
+ * Set up an io_uring instance and map its rings.
+ * @param entries Number of submission queue entries.
+ * @return Ring* the instance, or null if the kernel doesn't allow one.
+ */
+static Ring *makeRing( unsigned int entries )
+{
+  struct io_uring_params p;
+  memset( &p, 0, sizeof( p ) );
+  int fd = syscall( __NR_io_uring_setup, entries, &p );
+  if ( fd < 0 )
+    return NULL;
+
+  Ring *q = (Ring *) malloc( sizeof( Ring ) );
+  q->fd = fd;
+  q->sqRingSize = p.sq_off.array + p.sq_entries * sizeof( unsigned int );
+  q->cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof( struct io_uring_cqe );
+  q->sqesSize = p.sq_entries * sizeof( struct io_uring_sqe );
+
+  //newer kernels put both rings in one mapping
+  bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+  if ( single && q->cqRingSize > q->sqRingSize )
+    q->sqRingSize = q->cqRingSize;
+
+  q->sqRing = mmap( NULL, q->sqRingSize, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING );
+  q->cqRing = single ? q->sqRing
+    : mmap( NULL, q->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            fd, IORING_OFF_CQ_RING );
+  q->sqes = (struct io_uring_sqe *)
+    mmap( NULL, q->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+          fd, IORING_OFF_SQES );
+  if ( q->sqRing == MAP_FAILED || q->cqRing == MAP_FAILED || q->sqes == MAP_FAILED ) {
+    if ( q->sqRing != MAP_FAILED )
+      munmap( q->sqRing, q->sqRingSize );
+    if ( !single && q->cqRing != MAP_FAILED )
+      munmap( q->cqRing, q->cqRingSize );
+    if ( q->sqes != MAP_FAILED )
+      munmap( q->sqes, q->sqesSize );
+    close( fd );
+    free( q );
+    return NULL;
+  }
+
+  char *sq = (char *) q->sqRing;
+  char *cq = (char *) q->cqRing;
+  q->sqTail = (unsigned int *) ( sq + p.sq_off.tail );
+  q->sqMask = (unsigned int *) ( sq + p.sq_off.ring_mask );
+  q->sqArray = (unsigned int *) ( sq + p.sq_off.array );
+  q->cqHead = (unsigned int *) ( cq + p.cq_off.head );
+  q->cqTail = (unsigned int *) ( cq + p.cq_off.tail );
+  q->cqMask = (unsigned int *) ( cq + p.cq_off.ring_mask );
+  q->cqes = (struct io_uring_cqe *) ( cq + p.cq_off.cqes );
+  return q;
+}
+
+/**
+ * Unmap an io_uring instance and close it.
+ * @param q The instance to free.
+ */
+static void freeRing( Ring *q )
+{
+  munmap( q->sqes, q->sqesSize );
+  if ( q->cqRing != q->sqRing )
+    munmap( q->cqRing, q->cqRingSize );
+  munmap( q->sqRing, q->sqRingSize );
+  close( q->fd );
+  free( q );
+}
+
+/**
+ * Submit a read to an io_uring instance.
+ * @param q The instance.
+ * @param fd File to read.
+ * @param buf Where to put the bytes.
+ * @param len Number of bytes to read.
+ * @param off Offset in the file to read from.
+ * @param tag Value the completion is tagged with.
+ * @return bool true if the kernel took the read.
+ */
+static bool ringRead( Ring *q, int fd, char *buf, unsigned int len, long long off,
+                      unsigned long long tag )
+{
+  //only this process adds entries, so the tail can be read plainly
+  unsigned int tail = *q->sqTail;
+  unsigned int i = tail & *q->sqMask;
+  struct io_uring_sqe *sqe = &q->sqes[ i ];
+  memset( sqe, 0, sizeof( *sqe ) );
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = fd;
+  sqe->addr = (uintptr_t) buf;
+  sqe->len = len;
+  sqe->off = off;
+  sqe->user_data = tag;
+  q->sqArray[ i ] = i;
+  __atomic_store_n( q->sqTail, tail + 1, __ATOMIC_RELEASE );
+  return syscall( __NR_io_uring_enter, q->fd, 1, 0, 0, NULL, 0 ) == 1;
+}
+
+/**
+ * Wait for a read to complete, and take its result off the ring.
+ * @param q The instance.
+ * @param tag Filled in with the tag the read was submitted with.
+ * @return int number of bytes read, or a negative error number.
+ */
+static int ringWait( Ring *q, unsigned long long *tag )
+{
+  unsigned int head = *q->cqHead;
+  while ( head == __atomic_load_n( q->cqTail, __ATOMIC_ACQUIRE ) )
+    syscall( __NR_io_uring_enter, q->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0 );
+
+  struct io_uring_cqe *cqe = &q->cqes[ head & *q->cqMask ];
+  *tag = cqe->user_data;
+  int res = cqe->res;
+  __atomic_store_n( q->cqHead, head + 1, __ATOMIC_RELEASE );
+  return res;
+}
+
+/**
+ * Find the number of bytes in a block of the file.
+ * @param r The log.
+ * @param block Number of the block.
+ * @return int bytes in the block, zero if it's past the end of the file.
+ */
+static int blockLength( Replay *r, long long block )
+{
+  long long left = r->size - block * REPLAY_BLOCK;
+  return left <= 0 ? 0 : left < REPLAY_BLOCK ? left : REPLAY_BLOCK;
+}
+
+/**
+ * Send the rest of a block's read to the kernel, if it's read through a
+ * ring.  With pread, the read waits until the block is needed.
+ * @param r The log.
+ * @param block Number of the block.
+ */
+static void submitRest( Replay *r, long long block )
+{
+  int b = block % READ_AHEAD;
+  int want = blockLength( r, block );
+  r->busy[ b ] = true;
+  if ( r->ring && !ringRead( r->ring, r->fd, r->buf[ b ] + r->filled[ b ],
+                             want - r->filled[ b ],
+                             block * REPLAY_BLOCK + r->filled[ b ], block ) ) {
+    r->failed = true;
+    r->busy[ b ] = false;
+  }
+}
+
+/**
+ * Start reading a block into its buffer.
+ * @param r The log.
+ * @param block Number of the block.
+ */
+static void startBlock( Replay *r, long long block )
+{
+  if ( blockLength( r, block ) == 0 || r->failed )
+    return;
+  r->filled[ block % READ_AHEAD ] = 0;
+  submitRest( r, block );
+}
+
+/**
+ * Take one completed read off the ring, and send the rest of its block
+ * if it came up short.
+ * @param r The log.
+ */
+static void reapOne( Replay *r )
+{
+  unsigned long long block;
+  int res = ringWait( r->ring, &block );
+  int b = block % READ_AHEAD;
+  r->busy[ b ] = false;
+
+  //a file that shrank just ends early
+  if ( res < 0 )
+    r->failed = true;
+  else if ( res > 0 ) {
+    r->filled[ b ] += res;
+    if ( r->filled[ b ] < blockLength( r, block ) )
+      submitRest( r, block );
+  }
+}
+
+/**
+ * Wait for a block's read to finish.
+ * @param r The log.
+ * @param block Number of the block.
+ * @return int number of bytes in the block's buffer.
+ */
+static int finishBlock( Replay *r, long long block )
+{
+  int b = block % READ_AHEAD;
+  if ( r->ring ) {
+    while ( r->busy[ b ] )
+      reapOne( r );
+    return r->filled[ b ];
+  }
+
+  //without a ring, read the block now
+  int want = blockLength( r, block );
+  while ( r->busy[ b ] && r->filled[ b ] < want ) {
+    ssize_t res = pread( r->fd, r->buf[ b ] + r->filled[ b ], want - r->filled[ b ],
+                         block * REPLAY_BLOCK + r->filled[ b ] );
+    if ( res <= 0 ) {
+      r->failed = res < 0;
+      break;
+    }
+    r->filled[ b ] += res;
+  }
+  r->busy[ b ] = false;
+  return r->filled[ b ];
+}
+
+/**
+ * Move on to the next block, handing the current one's buffer back for
+ * the block READ_AHEAD further on.
+ * @param r The log.
+ * @return bool false at the end of the file.
+ */
+static bool nextBlock( Replay *r )
+{
+  if ( r->block >= 0 )
+    startBlock( r, r->block + READ_AHEAD );
+  r->block++;
+  if ( blockLength( r, r->block ) == 0 )
+    return false;
+
+  r->pos = 0;
+  r->len = finishBlock( r, r->block );
+  return r->len > 0 && !r->failed;
+}
+
+Replay *openReplay( char const *path )
+{
+  int fd = open( path, O_RDONLY );
+  struct stat st;
+  if ( fd < 0 || fstat( fd, &st ) != 0 ) {
+    if ( fd >= 0 )
+      close( fd );
+    return NULL;
+  }
+
+  Replay *r = (Replay *) malloc( sizeof( Replay ) );
+  r->fd = fd;
+  r->size = st.st_size;
+  r->ring = makeRing( READ_AHEAD );
+  for ( int b = 0; b < READ_AHEAD; b++ ) {
+    r->buf[ b ] = (char *) malloc( REPLAY_BLOCK );
+    r->busy[ b ] = false;
+  }
+  r->block = -1;
+  r->pos = r->len = 0;
+  r->failed = false;
+
+  //get the first blocks on their way
+  for ( int b = 0; b < READ_AHEAD; b++ )
+    startBlock( r, b );
+  return r;
+}
+
+/**
+ * Get the next byte of the log.
+ * @param r The log.
+ * @return int the byte, or EOF at the end of the file.
+ */
+static int nextByte( Replay *r )
+{
+  if ( r->pos == r->len && !nextBlock( r ) )
+    return EOF;
+  return (unsigned char) r->buf[ r->block % READ_AHEAD ][ r->pos++ ];
+}
+
+char *replayLine( Replay *r )
+{
+  //like readLine, the first character always starts a line, even if
+  //it's a linefeed
+  int ch = nextByte( r );
+  if ( ch == EOF )
+    return NULL;
+
+  int cap = INITIAL_LINE_CAPACITY;
+  int len = 0;
+  char *line = (char *) malloc( cap );
+  line[ len++ ] = ch;
+
+  //copy a run at a time, up to the next linefeed or the end of the block
+  for ( ;; ) {
+    if ( r->pos == r->len && !nextBlock( r ) )
+      break;
+    char const *start = r->buf[ r->block % READ_AHEAD ] + r->pos;
+    char const *lf = (char const *) memchr( start, '\n', r->len - r->pos );
+    int run = lf ? lf - start : r->len - r->pos;
+
+    //leave room for the null terminator
+    while ( len + run + 1 > cap ) {
+      cap *= 2;
+      line = (char *) realloc( line, cap );
+    }
+    memcpy( line + len, start, run );
+    len += run;
+    r->pos += run;
+    if ( lf ) {
+      r->pos++;
+      break;
+    }
+  }
+
+  line[ len ] = '\0';
+  return line;
+}
+
+bool closeReplay( Replay *r )
+{
+  //the kernel may still be writing into the buffers
+  if ( r->ring ) {
+    for ( int b = 0; b < READ_AHEAD; b++ )
+      while ( r->busy[ b ] )
+        reapOne( r );
+    freeRing( r->ring );
+  }
+
+  bool ok = !r->failed;
+  for ( int b = 0; b < READ_AHEAD; b++ )
+    free( r->buf[ b ] );
+  close( r->fd );
+  free( r );
+  return ok;
+}
@@ -0,0 +1,43 @@
+/**
+    @file replay.h
+    @author
+    Header for the replay component, which reads a command log from a
+    file a line at a time for the driver's replay mode.  Blocks of the
+    file are read ahead through io_uring, so the disk works on the next
+    few blocks while the caller parses and applies the current one.  On
+    kernels without io_uring, the blocks are read with pread instead.
+*/
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdbool.h>
+
+/** Incomplete type for an open command log. */
+typedef struct ReplayStruct Replay;
+
+/**
+ * Open a command log and start reading the first blocks of it.
+ * @param path Name of the file.
+ * @return Replay* the open log, or null if the file can't be opened.
+ */
+Replay *openReplay( char const *path );
+
+/**
+ * Read the next line of a command log, split the same way readLine
+ * splits its input.
+ * @param r The open log.
+ * @return char* the line without its linefeed, allocated for the caller
+ * to free, or null at the end of the file or if it can't be read.
+ */
+char *replayLine( Replay *r );
+
+/**
+ * Close a command log and free the memory it uses.  Reads still in
+ * flight are waited for first.
+ * @param r The log to close.
+ * @return bool false if a read failed, so replayLine stopped early.
+ */
+bool closeReplay( Replay *r );
+
+#endif
@@ -0,0 +1,562 @@
+/**
+    @file shmmap.c
+    @author
+    Hash map in a POSIX shared memory segment.  The segment starts with a
+    header, then the table of list heads, then an arena the entries are
+    carved from.  Every link is an offset from the start of the segment,
+    with zero meaning null, so the segment can be mapped at any address.
+
+    Writers hold the header's mutex and make the sequence counter odd
+    while they change anything.  Readers copy what they need out of the
+    segment and start over if the counter was odd or moved meanwhile.
+    Since a reader can see a list in the middle of a change, it loads
+    each offset and length once and checks it against the size of its
+    mapping before using it.  A reader that keeps finding the counter odd
+    tries the mutex, so a writer that died mid-change doesn't stall it.
+*/
+
+// shm_open, mmap and robust mutexes aren't part of C99.
+#define _DEFAULT_SOURCE
+
+#include "shmmap.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "integer.h"
+#include "text.h"
+
+/** Identifies a shared map segment, and its layout version. */
+#define SHM_MAGIC "VMAPSHM1"
+
+/** Smallest entry block is 1 << MIN_CLASS bytes. */
+#define MIN_CLASS 5
+
+/** Number of entry block sizes, each twice the last. */
+#define SHM_CLASSES 32
+
+/** Times a reader finds the counter odd before it checks for a dead writer. */
+#define READER_SPINS 1000
+
+/** Kinds of value stored in the segment. */
+enum { SHM_INTEGER, SHM_TEXT };
+
+/** Header at the start of the segment. */
+typedef struct {
+  /** SHM_MAGIC, without its null terminator. */
+  char magic[ 8 ];
+
+  /** Size of the whole segment. */
+  uint32_t bytes;
+
+  /** Length of the table. */
+  uint32_t tlen;
+
+  /** Number of key/value pairs. */
+  uint32_t size;
+
+  /** Offset of the first byte of the arena not handed out yet. */
+  uint32_t top;
+
+  /** Head of the list of free blocks of each size. */
+  uint32_t freeBlocks[ SHM_CLASSES ];
+
+  /** Sequence counter, odd while a writer is changing the map. */
+  uint32_t seq;
+
+  /** Held by the writer changing the map. */
+  pthread_mutex_t lock;
+} ShmHeader;
+
+/** Entry for one key/value pair, in a block of 1 << sizeClass bytes. */
+typedef struct {
+  /** Offset of the next entry in the list, or zero. */
+  uint32_t next;
+
+  /** Hash of the key. */
+  uint32_t hash;
+
+  /** Number of bytes in the key. */
+  uint32_t keyLen;
+
+  /** Number of bytes in the value. */
+  uint32_t valLen;
+
+  /** SHM_INTEGER or SHM_TEXT, for the key. */
+  uint8_t keyKind;
+
+  /** SHM_INTEGER or SHM_TEXT, for the value. */
+  uint8_t valKind;
+
+  /** Size of this entry's block, as a power of two. */
+  uint8_t sizeClass;
+
+  /** The key's bytes, then the value's. */
+  char data[];
+} ShmEntry;
+
+/** Representation of a process's attachment to a shared map. */
+struct SharedMapStruct {
+  /** Start of the mapped segment. */
+  char *base;
+
+  /** Size of the mapping. */
+  size_t bytes;
+
+  /** The segment's header, at its start. */
+  ShmHeader *header;
+
+  /** The table of list heads, right after the header. */
+  uint32_t *table;
+};
+
+/** Bytes of a key or value, as stored in the segment. */
+typedef struct {
+  /** SHM_INTEGER or SHM_TEXT. */
+  uint8_t kind;
+
+  /** The bytes. */
+  char const *bytes;
+
+  /** Number of bytes. */
+  uint32_t len;
+
+  /** Decoded copy of a Text's string that bytes points to, or null. */
+  char *copy;
+} ShmBytes;
+
+/**
+ * Find the bytes to store for a key or value.
+ * @param v Value to encode.
+ * @param b Filled in with its bytes.  Free its copy when done with it.
+ * @return bool true if v is an Integer or Text.
+ */
+static bool encode( VType const *v, ShmBytes *b )
+{
+  b->copy = NULL;
+  if ( isInteger( v ) ) {
+    b->kind = SHM_INTEGER;
+    b->bytes = (char const *) &( (Integer const *) v )->val;
+    b->len = sizeof( int );
+    return true;
+  }
+  if ( isText( v ) ) {
+    b->kind = SHM_TEXT;
+    b->bytes = textString( v, &b->copy );
+    b->len = strlen( b->bytes );
+    return true;
+  }
+  return false;
+}
+
+/**
+ * Hash a key's bytes, with the Jenkins one-at-a-time hash.  Every
+ * process has to agree on it, whatever Text hash each one selected.
+ * @param b Key to hash.
+ * @return uint32_t the key's hash.
+ */
+static uint32_t hashBytes( ShmBytes const *b )
+{
+  uint32_t h = b->kind;
+  for ( uint32_t i = 0; i < b->len; i++ ) {
+    h += (unsigned char) b->bytes[ i ];
+    h += h << 10;
+    h ^= h >> 6;
+  }
+  h += h << 3;
+  h ^= h >> 11;
+  h += h << 15;
+  return h;
+}
+
+/**
+ * Get the offset of the first entry in the arena, just past the table.
+ * @param h Header of the segment.
+ * @return uint32_t offset of the start of the arena.
+ */
+static uint32_t arenaStart( ShmHeader const *h )
+{
+  uint32_t off = sizeof( ShmHeader ) + h->tlen * sizeof( uint32_t );
+  return ( off + 7 ) & ~7u;
+}
+
+/**
+ * Turn an offset into an entry pointer, if a whole entry header fits
+ * there.  A reader racing with a writer can see any offset at all.
+ * @param m Shared map the entry is in.
+ * @param off Offset of the entry.
+ * @return ShmEntry* the entry, or null for a zero or bad offset.
+ */
+static ShmEntry *entryAt( SharedMap *m, uint32_t off )
+{
+  if ( off < arenaStart( m->header ) || (uint64_t) off + sizeof( ShmEntry ) > m->bytes )
+    return NULL;
+  return (ShmEntry *) ( m->base + off );
+}
+
+/**
+ * Report whether some number of an entry's data bytes fit inside the
+ * mapping.  Callers pass lengths they've already loaded, since a writer
+ * can change the entry's own fields at any time.
+ * @param m Shared map the entry is in.
+ * @param e Entry to check.
+ * @param len Number of data bytes, from the start of the key.
+ * @return bool true if all of those bytes are inside the mapping.
+ */
+static bool dataFits( SharedMap *m, ShmEntry const *e, uint64_t len )
+{
+  return (uint64_t) ( (char const *) e->data - m->base ) + len <= m->bytes;
+}
+
+/**
+ * Find the entry for a key.  Writers call this holding the lock; readers
+ * call it inside a sequence check, so it never trusts what it reads.
+ * @param m Shared map to search.
+ * @param key Key to look for.
+ * @param h Hash of the key.
+ * @param link Filled in, if not null, with the link that points to the
+ * entry, or to zero at the end of its list.
+ * @return ShmEntry* the entry with the key, or null.
+ */
+static ShmEntry *findEntry( SharedMap *m, ShmBytes const *key, uint32_t h, uint32_t **link )
+{
+  uint32_t *l = &m->table[ h % m->header->tlen ];
+
+  //a list can't have more entries than fit in the segment
+  uint32_t limit = m->bytes >> MIN_CLASS;
+  ShmEntry *e;
+  while ( ( e = entryAt( m, __atomic_load_n( l, __ATOMIC_RELAXED ) ) ) && limit-- > 0 ) {
+    //the compare only uses the key's own length, once it's known to fit
+    if ( __atomic_load_n( &e->hash, __ATOMIC_RELAXED ) == h &&
+         __atomic_load_n( &e->keyKind, __ATOMIC_RELAXED ) == key->kind &&
+         __atomic_load_n( &e->keyLen, __ATOMIC_RELAXED ) == key->len &&
+         dataFits( m, e, key->len ) && memcmp( e->data, key->bytes, key->len ) == 0 )
+      break;
+    l = &e->next;
+  }
+
+  if ( link )
+    *link = l;
+  return limit == (uint32_t) -1 ? NULL : e;
+}
+
+/**
+ * Take the mutex, recovering it if a writer died holding it.  Writers
+ * never change an entry that's linked in; they link a new, filled entry
+ * in with one store, so a dead writer leaves the lists whole and every
+ * linked entry intact, and the counter just needs to be even.
+ * @param m Shared map to lock.
+ * @param wait True to wait for the mutex, false to give up if it's held.
+ * @return int zero if this process now holds the mutex, or EBUSY.
+ */
+static int takeLock( SharedMap *m, bool wait )
+{
+  int err = wait ? pthread_mutex_lock( &m->header->lock )
+    : pthread_mutex_trylock( &m->header->lock );
+  if ( err == EOWNERDEAD ) {
+    pthread_mutex_consistent( &m->header->lock );
+    if ( __atomic_load_n( &m->header->seq, __ATOMIC_RELAXED ) & 1 )
+      __atomic_add_fetch( &m->header->seq, 1, __ATOMIC_RELEASE );
+    err = 0;
+  }
+  return err;
+}
+
+/**
+ * Take the writer lock, and make the counter odd for the change.
+ * @param m Shared map to lock.
+ */
+static void writeLock( SharedMap *m )
+{
+  takeLock( m, true );
+
+  //readers starting now will wait, readers already going will retry
+  __atomic_add_fetch( &m->header->seq, 1, __ATOMIC_RELAXED );
+  __atomic_thread_fence( __ATOMIC_RELEASE );
+}
+
+/**
+ * Finish a change and release the writer lock.
+ * @param m Shared map to unlock.
+ */
+static void writeUnlock( SharedMap *m )
+{
+  __atomic_add_fetch( &m->header->seq, 1, __ATOMIC_RELEASE );
+  pthread_mutex_unlock( &m->header->lock );
+}
+
+/**
+ * Get a block for an entry with the given number of data bytes, reusing
+ * a free block of the right size if there is one.
+ * @param m Shared map to allocate in.
+ * @param dataLen Number of bytes of key and value.
+ * @return ShmEntry* the new entry, with its size class filled in, or
+ * null if the segment is full.
+ */
+static ShmEntry *allocEntry( SharedMap *m, uint32_t dataLen )
+{
+  uint64_t need = sizeof( ShmEntry ) + (uint64_t) dataLen;
+  int c = MIN_CLASS;
+  while ( c < SHM_CLASSES && ( (uint64_t) 1 << c ) < need )
+    c++;
+  if ( c == SHM_CLASSES )
+    return NULL;
+
+  ShmHeader *h = m->header;
+  ShmEntry *e;
+  if ( h->freeBlocks[ c ] ) {
+    e = (ShmEntry *) ( m->base + h->freeBlocks[ c ] );
+    h->freeBlocks[ c ] = e->next;
+  } else {
+    if ( (uint64_t) h->top + ( (uint64_t) 1 << c ) > h->bytes )
+      return NULL;
+    e = (ShmEntry *) ( m->base + h->top );
+    h->top += (uint32_t) 1 << c;
+  }
+
+  e->sizeClass = c;
+  return e;
+}
+
+/**
+ * Put an entry's block on the free list for its size.  Readers may still
+ * be looking at it; the sequence check sends them back to start over.
+ * @param m Shared map the entry is in.
+ * @param e Entry to free.
+ */
+static void freeEntry( SharedMap *m, ShmEntry *e )
+{
+  e->next = m->header->freeBlocks[ e->sizeClass ];
+  m->header->freeBlocks[ e->sizeClass ] = (char *) e - m->base;
+}
+
+/**
+ * Map a shared memory segment and find the map in it.
+ * @param fd Open descriptor for the segment.
+ * @param bytes Size of the segment.
+ * @return SharedMap* the attachment, or null if the segment can't be mapped.
+ */
+static SharedMap *attach( int fd, size_t bytes )
+{
+  void *base = mmap( NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+  close( fd );
+  if ( base == MAP_FAILED )
+    return NULL;
+
+  SharedMap *m = (SharedMap *) malloc( sizeof( SharedMap ) );
+  m->base = (char *) base;
+  m->bytes = bytes;
+  m->header = (ShmHeader *) base;
+  m->table = (uint32_t *) ( m->base + sizeof( ShmHeader ) );
+  return m;
+}
+
+SharedMap *makeSharedMap( char const *name, int len, long bytes )
+{
+  if ( len < 1 || bytes > UINT32_MAX ||
+       bytes < (long) sizeof( ShmHeader ) + (long) len * (long) sizeof( uint32_t ) + 8 )
+    return NULL;
+
+  //the segment must be new, so two makers can't both initialize it
+  int fd = shm_open( name, O_RDWR | O_CREAT | O_EXCL, 0600 );
+  if ( fd < 0 )
+    return NULL;
+  if ( ftruncate( fd, bytes ) != 0 ) {
+    close( fd );
+    shm_unlink( name );
+    return NULL;
+  }
+  SharedMap *m = attach( fd, bytes );
+  if ( !m ) {
+    shm_unlink( name );
+    return NULL;
+  }
+
+  //a new segment is all zeros, so the table starts out empty
+  ShmHeader *h = m->header;
+  h->bytes = bytes;
+  h->tlen = len;
+  h->size = 0;
+  h->top = arenaStart( h );
+  h->seq = 0;
+
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init( &attr );
+  pthread_mutexattr_setpshared( &attr, PTHREAD_PROCESS_SHARED );
+  pthread_mutexattr_setrobust( &attr, PTHREAD_MUTEX_ROBUST );
+  pthread_mutex_init( &h->lock, &attr );
+  pthread_mutexattr_destroy( &attr );
+
+  //the magic goes in last, so nobody attaches to a half-made map
+  __atomic_thread_fence( __ATOMIC_RELEASE );
+  memcpy( h->magic, SHM_MAGIC, sizeof( h->magic ) );
+  return m;
+}
+
+SharedMap *openSharedMap( char const *name )
+{
+  int fd = shm_open( name, O_RDWR, 0 );
+  if ( fd < 0 )
+    return NULL;
+
+  struct stat st;
+  if ( fstat( fd, &st ) != 0 || st.st_size < (off_t) sizeof( ShmHeader ) ) {
+    close( fd );
+    return NULL;
+  }
+  SharedMap *m = attach( fd, st.st_size );
+  if ( !m )
+    return NULL;
+
+  //make sure it's a finished map that fits in the segment
+  ShmHeader const *h = m->header;
+  if ( memcmp( h->magic, SHM_MAGIC, sizeof( h->magic ) ) != 0 ||
+       h->bytes != (uint64_t) st.st_size || h->tlen == 0 ||
+       arenaStart( h ) > h->bytes ) {
+    freeSharedMap( m );
+    return NULL;
+  }
+  return m;
+}
+
+int sharedMapSize( SharedMap *m )
+{
+  return __atomic_load_n( &m->header->size, __ATOMIC_RELAXED );
+}
+
+bool sharedMapSet( SharedMap *m, VType *key, VType *val )
+{
+  ShmBytes k, v;
+  if ( !encode( key, &k ) || !encode( val, &v ) ) {
+    free( k.copy );
+    return false;
+  }
+  uint32_t h = hashBytes( &k );
+
+  writeLock( m );
+  uint32_t *link;
+  ShmEntry *e = findEntry( m, &k, h, &link );
+
+  //fill in a new entry, even to replace a value, then link it in with a
+  //single store, so a writer dying part way never leaves a torn entry
+  bool ok = true;
+  ShmEntry *n = allocEntry( m, k.len + v.len );
+  if ( n ) {
+    n->hash = h;
+    n->keyKind = k.kind;
+    n->keyLen = k.len;
+    n->valKind = v.kind;
+    n->valLen = v.len;
+    memcpy( n->data, k.bytes, k.len );
+    memcpy( n->data + k.len, v.bytes, v.len );
+    n->next = e ? e->next : 0;
+    __atomic_store_n( link, (uint32_t) ( (char *) n - m->base ), __ATOMIC_RELEASE );
+    if ( e )
+      freeEntry( m, e );
+    else
+      m->header->size++;
+  } else
+    ok = false;
+
+  writeUnlock( m );
+  free( k.copy );
+  free( v.copy );
+  return ok;
+}
+
+VType *sharedMapGet( SharedMap *m, VType *key )
+{
+  ShmBytes k;
+  if ( !encode( key, &k ) )
+    return NULL;
+  uint32_t h = hashBytes( &k );
+
+  //copy the value out, starting over if a writer got in the way
+  char *buf = NULL;
+  uint32_t len = 0;
+  uint8_t kind = SHM_INTEGER;
+  bool found;
+  int spins = 0;
+  for ( ;; ) {
+    uint32_t seq = __atomic_load_n( &m->header->seq, __ATOMIC_ACQUIRE );
+    if ( seq & 1 ) {
+      //if the writer is taking a while, see whether it died; taking the
+      //mutex from a dead writer evens the counter
+      if ( ++spins % READER_SPINS == 0 && takeLock( m, false ) == 0 )
+        pthread_mutex_unlock( &m->header->lock );
+      sched_yield();
+      continue;
+    }
+
+    //load the value's kind and length once, and copy only what was
+    //checked, since a writer can change them at any time
+    ShmEntry *e = findEntry( m, &k, h, NULL );
+    found = false;
+    if ( e ) {
+      kind = __atomic_load_n( &e->valKind, __ATOMIC_RELAXED );
+      len = __atomic_load_n( &e->valLen, __ATOMIC_RELAXED );
+      found = dataFits( m, e, (uint64_t) k.len + len );
+    }
+    if ( found ) {
+      buf = (char *) realloc( buf, len + 1 );
+      memcpy( buf, e->data + k.len, len );
+    }
+
+    __atomic_thread_fence( __ATOMIC_ACQUIRE );
+    if ( __atomic_load_n( &m->header->seq, __ATOMIC_RELAXED ) == seq )
+      break;
+  }
+  free( k.copy );
+
+  VType *v = NULL;
+  if ( found && kind == SHM_INTEGER && len == sizeof( int ) ) {
+    int i;
+    memcpy( &i, buf, sizeof( int ) );
+    v = makeInteger( i );
+  } else if ( found && kind == SHM_TEXT ) {
+    buf[ len ] = '\0';
+    v = makeText( buf );
+  }
+  free( buf );
+  return v;
+}
+
+bool sharedMapRemove( SharedMap *m, VType *key )
+{
+  ShmBytes k;
+  if ( !encode( key, &k ) )
+    return false;
+  uint32_t h = hashBytes( &k );
+
+  writeLock( m );
+  uint32_t *link;
+  ShmEntry *e = findEntry( m, &k, h, &link );
+  if ( e ) {
+    __atomic_store_n( link, e->next, __ATOMIC_RELEASE );
+    freeEntry( m, e );
+    m->header->size--;
+  }
+  writeUnlock( m );
+
+  free( k.copy );
+  return e != NULL;
+}
+
+void freeSharedMap( SharedMap *m )
+{
+  munmap( m->base, m->bytes );
+  free( m );
+}
+
+bool unlinkSharedMap( char const *name )
+{
+  return shm_unlink( name ) == 0;
+}
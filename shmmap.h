@@ -0,0 +1,97 @@
+/**
+    @file shmmap.h
+    @author
+    Header for the shared map component, a hash map that lives in a POSIX
+    shared memory segment so several processes can use one copy of it.
+    Function pointers don't mean anything in another process, so the
+    segment holds Integer and Text keys and values as tagged bytes, and
+    its lists are linked by offsets into the segment rather than pointers.
+
+    Any number of processes can attach.  Changes are made under a robust
+    process-shared mutex, and readers never take it: each lookup checks a
+    sequence counter the writers advance, and retries if a change
+    overlapped it.  If a writer dies mid-change, the next writer, or a
+    reader that has waited a while, recovers the mutex.  The segment has
+    a fixed size, and its table a fixed length, both chosen when it's
+    made.
+*/
+
+#ifndef SHMMAP_H
+#define SHMMAP_H
+
+#include <stdbool.h>
+
+#include "vtype.h"
+
+/** Incomplete type for a process's attachment to a shared map. */
+typedef struct SharedMapStruct SharedMap;
+
+/**
+ * Make a new shared memory segment holding an empty map, and attach to
+ * it.  The segment stays until unlinkSharedMap removes it.
+ * @param name Name of the segment, starting with a slash.
+ * @param len Length of the hash table.
+ * @param bytes Size of the whole segment, at most 4 GiB.
+ * @return SharedMap* the new map, or null if the segment already exists
+ * or can't be made.
+ */
+SharedMap *makeSharedMap( char const *name, int len, long bytes );
+
+/**
+ * Attach to a shared map another process made.
+ * @param name Name of the segment.
+ * @return SharedMap* the map, or null if there's no such shared map.
+ */
+SharedMap *openSharedMap( char const *name );
+
+/**
+ * Get the number of key/value pairs in a shared map.
+ * @param m Pointer to the shared map.
+ * @return int number of keys.
+ */
+int sharedMapSize( SharedMap *m );
+
+/**
+ * Copy a key/value pair into a shared map, replacing any value the key
+ * already had.  Unlike mapSet, the caller still owns key and val.
+ * @param m Pointer to the shared map.
+ * @param key Key to set, an Integer or Text.
+ * @param val Value for the key, an Integer or Text.
+ * @return bool true if the pair was stored, false if the key or value
+ * isn't an Integer or Text, or the segment is full.
+ */
+bool sharedMapSet( SharedMap *m, VType *key, VType *val );
+
+/**
+ * Look up the value for a key in a shared map.
+ * @param m Pointer to the shared map.
+ * @param key Key to look up.
+ * @return VType* a new copy of the value, for the caller to destroy, or
+ * null if the key isn't in the map.
+ */
+VType *sharedMapGet( SharedMap *m, VType *key );
+
+/**
+ * Remove a key and its value from a shared map.
+ * @param m Pointer to the shared map.
+ * @param key Key to remove.
+ * @return bool true if the key was in the map and was removed.
+ */
+bool sharedMapRemove( SharedMap *m, VType *key );
+
+/**
+ * Detach from a shared map.  The map stays in the segment for other
+ * processes.
+ * @param m The shared map to detach from.
+ */
+void freeSharedMap( SharedMap *m );
+
+/**
+ * Remove a shared map's segment.  Processes still attached keep using
+ * it until they detach.
+ * @param name Name of the segment.
+ * @return bool true if the segment was removed.
+ */
+bool unlinkSharedMap( char const *name );
+
+#endif
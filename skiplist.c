@@ -0,0 +1,177 @@
+/**
+    @file skiplist.c
+    @author
+    Skiplist implementation of an ordered set of int keys.
+*/
+
+#include "skiplist.h"
+#include <stdlib.h>
+
+/** Largest number of levels a skiplist node can have. With a 1/4
+    promotion rate this comfortably covers billions of keys. */
+#define MAX_LEVEL 16
+
+/** Seed for the level generator, any non-zero value works. */
+#define LEVEL_SEED 0x9E3779B9u
+
+/** Node in the skiplist.  The forward pointers are allocated inline,
+    so a node is a single small block no matter how tall it is. */
+typedef struct SkipNodeStruct {
+  /** Key stored in this node. */
+  int key;
+
+  /** Number of forward pointers in this node. */
+  int level;
+
+  /** Next node at each level, from the bottom level up. */
+  struct SkipNodeStruct *next[];
+} SkipNode;
+
+/** Representation of a skiplist. */
+struct SkipListStruct {
+  /** Sentinel node before the first key, with MAX_LEVEL pointers. */
+  SkipNode *head;
+
+  /** Number of levels currently in use. */
+  int level;
+
+  /** State of the random level generator. */
+  unsigned int seed;
+};
+
+/**
+ * Allocate a skiplist node with the given key and number of levels.
+ * @param key Key for the new node.
+ * @param level Number of forward pointers the node needs.
+ * @return SkipNode* the new node, with all forward pointers null.
+ */
+static SkipNode *makeSkipNode( int key, int level )
+{
+  SkipNode *n = (SkipNode *) malloc( sizeof( SkipNode ) +
+                                     level * sizeof( SkipNode * ) );
+  n->key = key;
+  n->level = level;
+  for ( int i = 0; i < level; i++ )
+    n->next[ i ] = NULL;
+  return n;
+}
+
+/**
+ * Pick a level for a new node, promoting with probability 1/4 so nodes
+ * stay short and searches touch fewer cache lines.
+ * @param s Skiplist the node is for.
+ * @return int level between 1 and MAX_LEVEL.
+ */
+static int randomLevel( SkipList *s )
+{
+  //advance the xorshift generator
+  s->seed ^= s->seed << 13;
+  s->seed ^= s->seed >> 17;
+  s->seed ^= s->seed << 5;
+
+  //every pair of zero bits promotes the node one more level
+  unsigned int bits = s->seed;
+  int level = 1;
+  while ( level < MAX_LEVEL && ( bits & 3 ) == 0 ) {
+    bits >>= 2;
+    level++;
+  }
+  return level;
+}
+
+/**
+ * Find, at every level, the last node with a key smaller than the given one.
+ * @param s Skiplist to search.
+ * @param key Key to search for.
+ * @param update Filled in with the predecessor at each level.
+ * @return SkipNode* the first node with a key not smaller than key, or null.
+ */
+static SkipNode *findPredecessors( SkipList *s, int key, SkipNode **update )
+{
+  SkipNode *current = s->head;
+  for ( int i = s->level - 1; i >= 0; i-- ) {
+    while ( current->next[ i ] && current->next[ i ]->key < key )
+      current = current->next[ i ];
+    update[ i ] = current;
+  }
+  return current->next[ 0 ];
+}
+
+SkipList *makeSkipList( void )
+{
+  SkipList *s = (SkipList *) malloc( sizeof( SkipList ) );
+  s->head = makeSkipNode( 0, MAX_LEVEL );
+  s->level = 1;
+  s->seed = LEVEL_SEED;
+  return s;
+}
+
+void skipListInsert( SkipList *s, int key )
+{
+  //find where the key belongs, and stop if it's already there
+  SkipNode *update[ MAX_LEVEL ];
+  SkipNode *found = findPredecessors( s, key, update );
+  if ( found && found->key == key )
+    return;
+
+  //levels above the current height are preceded by the head
+  int level = randomLevel( s );
+  for ( int i = s->level; i < level; i++ )
+    update[ i ] = s->head;
+  if ( level > s->level )
+    s->level = level;
+
+  //splice the new node in at each of its levels
+  SkipNode *n = makeSkipNode( key, level );
+  for ( int i = 0; i < level; i++ ) {
+    n->next[ i ] = update[ i ]->next[ i ];
+    update[ i ]->next[ i ] = n;
+  }
+}
+
+bool skipListRemove( SkipList *s, int key )
+{
+  SkipNode *update[ MAX_LEVEL ];
+  SkipNode *found = findPredecessors( s, key, update );
+  if ( !found || found->key != key )
+    return false;
+
+  //unlink the node from every level it appears in
+  for ( int i = 0; i < found->level; i++ )
+    update[ i ]->next[ i ] = found->next[ i ];
+  free( found );
+
+  //drop levels that no longer have any nodes
+  while ( s->level > 1 && !s->head->next[ s->level - 1 ] )
+    s->level--;
+
+  return true;
+}
+
+int skipListRange( SkipList *s, int lo, int hi,
+                   void (*visit)( int key, void *data ), void *data )
+{
+  SkipNode *update[ MAX_LEVEL ];
+  int count = 0;
+
+  //walk the bottom level from the first key in range
+  for ( SkipNode *n = findPredecessors( s, lo, update );
+        n && n->key <= hi; n = n->next[ 0 ] ) {
+    visit( n->key, data );
+    count++;
+  }
+
+  return count;
+}
+
+void freeSkipList( SkipList *s )
+{
+  //every node, including the head, is on the bottom level
+  SkipNode *current = s->head;
+  while ( current ) {
+    SkipNode *nextNode = current->next[ 0 ];
+    free( current );
+    current = nextNode;
+  }
+  free( s );
+}
@@ -0,0 +1,55 @@
+/**
+    @file skiplist.h
+    @author
+    Header for the skiplist component, an ordered set of int keys used
+    as a secondary index over the Integer keys of a map.
+*/
+
+#ifndef SKIPLIST_H
+#define SKIPLIST_H
+
+#include <stdbool.h>
+
+/** Incomplete type for the SkipList representation. */
+typedef struct SkipListStruct SkipList;
+
+/** Make an empty skiplist.
+    @return pointer to a new skiplist.
+*/
+SkipList *makeSkipList( void );
+
+/**
+ * Add the given key to the skiplist.  Adding a key that is already
+ * present has no effect.
+ * @param s Pointer to the skiplist.
+ * @param key Key to add.
+ */
+void skipListInsert( SkipList *s, int key );
+
+/**
+ * Remove the given key from the skiplist.
+ * @param s Pointer to the skiplist.
+ * @param key Key to remove.
+ * @return true if the key was present and was removed.
+ */
+bool skipListRemove( SkipList *s, int key );
+
+/**
+ * Call the given function on every key in the closed range [lo, hi],
+ * in ascending order.
+ * @param s Pointer to the skiplist.
+ * @param lo Smallest key to visit.
+ * @param hi Largest key to visit.
+ * @param visit Function called for each key in the range.
+ * @param data Passed through to every call of visit.
+ * @return Number of keys visited.
+ */
+int skipListRange( SkipList *s, int lo, int hi,
+                   void (*visit)( int key, void *data ), void *data );
+
+/** Free all the memory used by a skiplist.
+    @param s The skiplist to free.
+*/
+void freeSkipList( SkipList *s );
+
+#endif
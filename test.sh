@@ -141,6 +141,36 @@ runTest() {
   return 0
 }
 
+# Replay all the driver test inputs at once, and check each one's output.
+runReplayTest() {
+  echo "Test replay"
+  rm -f input-*.txt.out stderr.txt
+
+  echo "   ./driver -r -j 3 input-*.txt 2> stderr.txt"
+  ./driver -r -j 3 input-*.txt 2> stderr.txt
+  ASTATUS=$?
+
+  if ! checkStatus 0 "$ASTATUS" ||
+     ! checkEmpty "Stderr output" "stderr.txt"
+  then
+      FAIL=1
+      return 1
+  fi
+
+  for INPUT in input-*.txt; do
+      TESTNO=${INPUT#input-}
+      TESTNO=${TESTNO%.txt}
+      if ! checkFile "Replay output" "expected-$TESTNO.txt" "$INPUT.out"; then
+          FAIL=1
+          return 1
+      fi
+  done
+
+  rm -f input-*.txt.out
+  echo "Test replay PASS"
+  return 0
+}
+
 # make a fresh copy of the target program
 make clean
 make
@@ -162,6 +192,10 @@ if [ -x driver ]; then
     runTest 10
     runTest 11
     runTest 12
+    runTest 13
+    runTest 14
+    runTest 15
+    runReplayTest
 else
     fail "Your driver program didn't compile, so it couldn't be tested."
 fi
@@ -10,13 +10,157 @@
 #include <stdio.h>
 #include <string.h>
 #include <ctype.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+#include <immintrin.h>
+#endif
+
+/** Number of texts the AVX2 batch kernel hashes at once. */
+#define AVX2_LANES 16
+
+/** Number of texts the SSE2 batch kernel hashes at once. */
+#define SSE2_LANES 8
+
+/** Largest number of texts any batch kernel hashes at once. */
+#define MAX_LANES AVX2_LANES
+
+/** Secrets for the word-at-a-time hash, the ones wyhash uses. */
+#define WIDE_SECRET0 0x2d358dccaa6c78a5ull
+#define WIDE_SECRET1 0x8bb84b93962eacc9ull
+#define WIDE_SECRET2 0x4b33a62ed433d4a3ull
+
+/** Size of each block of a pool's arena, unless a string needs more. */
+#define POOL_CHUNK_SIZE 4096
+
+/** Initial number of slots in a pool's hash set, a power of two. */
+#define POOL_INITIAL_SLOTS 64
+
+/** Number of free lists in a pool, one for each entry size up to a whole
+    arena block.  Entries bigger than that get their own allocation. */
+#define POOL_CLASSES ( POOL_CHUNK_SIZE / sizeof( void * ) + 1 )
+
+/** A string interned in a pool, stored in the pool's arena with its
+    length and hash in front of it. */
+typedef struct {
+    /** Number of Texts using this string. */
+    unsigned int refs;
+
+    /** Hash of the string, for the pool's hash set. */
+    unsigned int hash;
+
+    /** Length of the string, not counting the null terminator. */
+    int len;
+
+    /** The string itself, null terminated. */
+    char str[];
+} PoolEntry;
+
+/** Released entry waiting on one of a pool's free lists, written over
+    the start of the entry. */
+typedef struct PoolFreeStruct {
+    /** Next released entry of the same size. */
+    struct PoolFreeStruct *next;
+} PoolFree;
+
+/** Block of a pool's arena.  Blocks never move, so Texts can point
+    straight at the strings in them. */
+typedef struct PoolChunkStruct {
+    /** Next older block. */
+    struct PoolChunkStruct *next;
+
+    /** Number of bytes of data handed out so far. */
+    size_t used;
+
+    /** Number of bytes of data in this block. */
+    size_t cap;
+
+    /** Space for pool entries. */
+    char data[];
+} PoolChunk;
+
+/** Representation of a pool of interned strings. */
+struct TextPoolStruct {
+    /** Blocks of the arena, newest first.  Entries come from the first. */
+    PoolChunk *chunks;
+
+    /** Open-addressed hash set of the entries in use, null when empty. */
+    PoolEntry **slots;
+
+    /** Number of slots in the set, a power of two. */
+    unsigned int cap;
+
+    /** Number of entries in the set. */
+    unsigned int count;
+
+    /** Bytes the pool has from malloc, for its blocks, big entries and set. */
+    size_t bytes;
+
+    /** Released entries of each size, in units of a pointer, for poolAlloc
+        to hand out again before taking new space from the arena. */
+    PoolFree *free[ POOL_CLASSES ];
+};
+
+/**
+ * Read the next character of a string that may hold escape sequences, the
+ * way parseText decodes them.  An unknown escape is just the character
+ * after the backslash.
+ * @param p Position in the string, moved past the character.
+ * @param escaped True if the string still holds escape sequences.
+ * @return char the decoded character, or the null terminator.
+ */
+static char nextChar( char const **p, bool escaped )
+{
+    char c = *( *p )++;
+    if ( c != '\\' || !escaped )
+        return c;
+
+    //a parsed string never ends in a lone backslash
+    c = *( *p )++;
+    return c == 'n' ? '\n' : c == 't' ? '\t' : c;
+}
+
+/**
+ * Decode a string that may hold escape sequences.  Decoding only ever
+ * shrinks a string, so out can be the same as in.
+ * @param in String to decode.
+ * @param out Where to put the decoded string, with room for all of in.
+ */
+static void decode( char const *in, char *out )
+{
+    while ( ( *out++ = nextChar( &in, true ) ) )
+        ;
+}
+
+char const *textString( VType const *v, char **copy )
+{
+    Text const *this = (Text const *) v;
+    *copy = NULL;
+    if ( !this->escaped )
+        return this->str;
+
+    *copy = (char *) malloc( strlen( this->str ) + 1 );
+    decode( this->str, *copy );
+    return *copy;
+}
 
 // print method for Text.
 static void print( VType const *v )
 {
     // Convert the VType pointer to a more specific type then print.
     Text const *this = (Text const *) v;
-    printf( "\"%s\"", this->str );
+    if ( !this->escaped ) {
+        printf( "\"%s\"", this->str );
+        return;
+    }
+
+    // Print the decoded characters as they're read.
+    putchar( '"' );
+    char const *str = this->str;
+    for ( char c; ( c = nextChar( &str, true ) ); )
+        putchar( c );
+    putchar( '"' );
 }
 
 // equals method for Text.
@@ -27,11 +171,26 @@ static bool equals( VType const *a, VType const *b )
     if ( b->print != print )
         return false;
 
+    // Strings interned in the same pool are equal only if they're shared.
+    Text const *ta = (Text const *) a;
+    Text const *tb = (Text const *) b;
+    if ( ta->pool && ta->pool == tb->pool )
+        return ta->str == tb->str;
+
     // Extract the string from each of these Texts.
-    char *this = ( (Text const *) a )->str;
-    char *that = ( (Text const *) b )->str;
+    char const *this = ta->str;
+    char const *that = tb->str;
+    if ( !ta->escaped && !tb->escaped )
+        return strcmp( this, that ) == 0;
 
-    return strcmp( this, that ) == 0;
+    // Compare decoded characters, without decoding either string.
+    for ( ;; ) {
+        char c = nextChar( &this, ta->escaped );
+        if ( c != nextChar( &that, tb->escaped ) )
+            return false;
+        if ( !c )
+            return true;
+    }
 }
 
 // hash method for Text. Hashes the characters in the string using 
@@ -41,15 +200,14 @@ static unsigned int hash( VType const *v )
     //Convert the VType pointer specifically to Text
     Text const *this = (Text const *) v;
 
-    //Get the string from this and its length
-    char *str = this->str;
-    int len = strlen( str );
+    //Get the string from this, still escaped if it was parsed that way
+    char const *str = this->str;
 
-    // Jenkins 32-bit hash function implementation
-    unsigned int i = 0;
+    // Jenkins 32-bit hash function implementation, over the decoded
+    // characters
     unsigned int hash = 0;
-    while ( i != len ) {
-        hash += str[ i++ ];
+    for ( char c; ( c = nextChar( &str, this->escaped ) ); ) {
+        hash += c;
         hash += hash << 10;
         hash ^= hash >> 6;
     }
@@ -59,110 +217,631 @@ static unsigned int hash( VType const *v )
     return hash;
 }
 
+/**
+ * Multiply two 64-bit values and fold the 128-bit product into 64 bits.
+ * @param a Left-hand value.
+ * @param b Right-hand value.
+ * @return uint64_t the high and low halves of the product, xored.
+ */
+static uint64_t wideMix( uint64_t a, uint64_t b )
+{
+#ifdef __SIZEOF_INT128__
+    __uint128_t r = (__uint128_t) a * b;
+    return (uint64_t) r ^ (uint64_t) ( r >> 64 );
+#else
+    //without a 128-bit type, combine the four 32-bit partial products
+    uint64_t ha = a >> 32, la = (uint32_t) a;
+    uint64_t hb = b >> 32, lb = (uint32_t) b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + ( rm0 << 32 );
+    uint64_t c = t < rl;
+    uint64_t lo = t + ( rm1 << 32 );
+    c += lo < t;
+    uint64_t hi = rh + ( rm0 >> 32 ) + ( rm1 >> 32 ) + c;
+    return lo ^ hi;
+#endif
+}
+
+/**
+ * Read eight bytes from a possibly unaligned address.
+ * @param p Address to read.
+ * @return uint64_t the bytes, in native byte order.
+ */
+static uint64_t read64( char const *p )
+{
+    uint64_t v;
+    memcpy( &v, p, sizeof( v ) );
+    return v;
+}
+
+/**
+ * Read four bytes from a possibly unaligned address.
+ * @param p Address to read.
+ * @return uint64_t the bytes, in native byte order.
+ */
+static uint64_t read32( char const *p )
+{
+    uint32_t v;
+    memcpy( &v, p, sizeof( v ) );
+    return v;
+}
+
+/**
+ * Hash a string sixteen bytes at a time with a wyhash-style multiply-mix,
+ * so it doesn't have a dependency through every byte like the Jenkins
+ * hash.
+ * @param p String to hash.
+ * @param len Number of bytes in the string.
+ * @return unsigned int the hash.
+ */
+static unsigned int wideHashBytes( char const *p, size_t len )
+{
+    uint64_t seed = wideMix( WIDE_SECRET0, WIDE_SECRET1 );
+    uint64_t a, b;
+    if ( len <= 16 ) {
+        if ( len >= 4 ) {
+            //two overlapping pairs of four-byte reads cover 4 to 16 bytes
+            size_t off = ( len >> 3 ) << 2;
+            a = ( read32( p ) << 32 ) | read32( p + off );
+            b = ( read32( p + len - 4 ) << 32 ) | read32( p + len - 4 - off );
+        } else if ( len > 0 ) {
+            a = ( (uint64_t) (unsigned char) p[ 0 ] << 16 ) |
+                ( (uint64_t) (unsigned char) p[ len >> 1 ] << 8 ) |
+                (unsigned char) p[ len - 1 ];
+            b = 0;
+        } else
+            a = b = 0;
+    } else {
+        //mix in sixteen bytes at a time, then the last sixteen
+        size_t i = len;
+        while ( i > 16 ) {
+            seed = wideMix( read64( p ) ^ WIDE_SECRET1, read64( p + 8 ) ^ seed );
+            p += 16;
+            i -= 16;
+        }
+        a = read64( p + i - 16 );
+        b = read64( p + i - 8 );
+    }
+
+    uint64_t h = wideMix( wideMix( a ^ WIDE_SECRET1, b ^ seed ) ^ WIDE_SECRET0 ^ len,
+                          WIDE_SECRET2 );
+    return (unsigned int) ( h ^ ( h >> 32 ) );
+}
+
+// Alternate hash method for Text, with the word-at-a-time hash.
+static unsigned int wideHash( VType const *v )
+{
+    //this reads whole words, so it needs the decoded string, which is a
+    //copy if the Text still holds escapes
+    char *copy;
+    char const *str = textString( v, &copy );
+    unsigned int h = wideHashBytes( str, strlen( str ) );
+    free( copy );
+    return h;
+}
+
+/** Hash method parseText gives to new Text objects. */
+static unsigned int (*selectedHash)( VType const *v ) = hash;
+
+void textSelectHash( TextHash which )
+{
+    selectedHash = which == TEXT_HASH_WIDE ? wideHash : hash;
+}
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+
+/**
+ * Get byte j of string k in a batch, for the Jenkins kernels.  Bytes are
+ * sign-extended, the same as the char additions in hash().  Past the end
+ * of a string this reads its null terminator, which the kernels ignore.
+ * The kernels gather their bytes with scalar loads like this one.
+ * Transposing sixteen-byte loads from each string measured no faster,
+ * since the mixing steps depend on each other and bound the speed, and
+ * map keys are often shorter than a block.
+ * @param str Strings in the batch.
+ * @param len Length of each string.
+ * @param k Index of the string.
+ * @param j Index of the byte.
+ * @return int the byte, sign-extended.
+ */
+static inline int laneByte( char const *const *str, int const *len, int k, int j )
+{
+    return (signed char) str[ k ][ j < len[ k ] ? j : len[ k ] ];
+}
+
+/**
+ * Jenkins hash of eight strings at once, one per 32-bit lane of two SSE2
+ * registers.  The two registers are independent, so the processor can
+ * overlap their dependency chains.  Each lane stops changing once its
+ * string runs out, so the results match hash() exactly.
+ * @param str Eight strings to hash.
+ * @param len Length of each string.
+ * @param maxLen Length of the longest string.
+ * @param out Filled in with the hash of each string.
+ */
+static void jenkinsSSE2( char const *const *str, int const *len, int maxLen,
+                         unsigned int *out )
+{
+    __m128i lensA = _mm_loadu_si128( (__m128i const *) len );
+    __m128i lensB = _mm_loadu_si128( (__m128i const *) ( len + 4 ) );
+    __m128i hA = _mm_setzero_si128();
+    __m128i hB = _mm_setzero_si128();
+
+    for ( int j = 0; j < maxLen; j++ ) {
+        //only lanes whose strings reach this position change
+        __m128i pos = _mm_set1_epi32( j );
+        __m128i maskA = _mm_cmpgt_epi32( lensA, pos );
+        __m128i maskB = _mm_cmpgt_epi32( lensB, pos );
+        __m128i cA = _mm_setr_epi32( laneByte( str, len, 0, j ), laneByte( str, len, 1, j ),
+                                     laneByte( str, len, 2, j ), laneByte( str, len, 3, j ) );
+        __m128i cB = _mm_setr_epi32( laneByte( str, len, 4, j ), laneByte( str, len, 5, j ),
+                                     laneByte( str, len, 6, j ), laneByte( str, len, 7, j ) );
+
+        __m128i tA = _mm_add_epi32( hA, cA );
+        __m128i tB = _mm_add_epi32( hB, cB );
+        tA = _mm_add_epi32( tA, _mm_slli_epi32( tA, 10 ) );
+        tB = _mm_add_epi32( tB, _mm_slli_epi32( tB, 10 ) );
+        tA = _mm_xor_si128( tA, _mm_srli_epi32( tA, 6 ) );
+        tB = _mm_xor_si128( tB, _mm_srli_epi32( tB, 6 ) );
+        hA = _mm_or_si128( _mm_and_si128( maskA, tA ), _mm_andnot_si128( maskA, hA ) );
+        hB = _mm_or_si128( _mm_and_si128( maskB, tB ), _mm_andnot_si128( maskB, hB ) );
+    }
+
+    hA = _mm_add_epi32( hA, _mm_slli_epi32( hA, 3 ) );
+    hB = _mm_add_epi32( hB, _mm_slli_epi32( hB, 3 ) );
+    hA = _mm_xor_si128( hA, _mm_srli_epi32( hA, 11 ) );
+    hB = _mm_xor_si128( hB, _mm_srli_epi32( hB, 11 ) );
+    hA = _mm_add_epi32( hA, _mm_slli_epi32( hA, 15 ) );
+    hB = _mm_add_epi32( hB, _mm_slli_epi32( hB, 15 ) );
+    _mm_storeu_si128( (__m128i *) out, hA );
+    _mm_storeu_si128( (__m128i *) ( out + 4 ), hB );
+}
+
+/**
+ * Jenkins hash of sixteen strings at once, the AVX2 version of
+ * jenkinsSSE2.  Only call this when the processor supports AVX2.
+ * @param str Sixteen strings to hash.
+ * @param len Length of each string.
+ * @param maxLen Length of the longest string.
+ * @param out Filled in with the hash of each string.
+ */
+__attribute__(( target( "avx2" ) ))
+static void jenkinsAVX2( char const *const *str, int const *len, int maxLen,
+                         unsigned int *out )
+{
+    __m256i lensA = _mm256_loadu_si256( (__m256i const *) len );
+    __m256i lensB = _mm256_loadu_si256( (__m256i const *) ( len + 8 ) );
+    __m256i hA = _mm256_setzero_si256();
+    __m256i hB = _mm256_setzero_si256();
+
+    for ( int j = 0; j < maxLen; j++ ) {
+        //only lanes whose strings reach this position change
+        __m256i pos = _mm256_set1_epi32( j );
+        __m256i maskA = _mm256_cmpgt_epi32( lensA, pos );
+        __m256i maskB = _mm256_cmpgt_epi32( lensB, pos );
+        __m256i cA = _mm256_setr_epi32( laneByte( str, len, 0, j ), laneByte( str, len, 1, j ),
+                                        laneByte( str, len, 2, j ), laneByte( str, len, 3, j ),
+                                        laneByte( str, len, 4, j ), laneByte( str, len, 5, j ),
+                                        laneByte( str, len, 6, j ), laneByte( str, len, 7, j ) );
+        __m256i cB = _mm256_setr_epi32( laneByte( str, len, 8, j ), laneByte( str, len, 9, j ),
+                                        laneByte( str, len, 10, j ), laneByte( str, len, 11, j ),
+                                        laneByte( str, len, 12, j ), laneByte( str, len, 13, j ),
+                                        laneByte( str, len, 14, j ), laneByte( str, len, 15, j ) );
+
+        __m256i tA = _mm256_add_epi32( hA, cA );
+        __m256i tB = _mm256_add_epi32( hB, cB );
+        tA = _mm256_add_epi32( tA, _mm256_slli_epi32( tA, 10 ) );
+        tB = _mm256_add_epi32( tB, _mm256_slli_epi32( tB, 10 ) );
+        tA = _mm256_xor_si256( tA, _mm256_srli_epi32( tA, 6 ) );
+        tB = _mm256_xor_si256( tB, _mm256_srli_epi32( tB, 6 ) );
+        hA = _mm256_blendv_epi8( hA, tA, maskA );
+        hB = _mm256_blendv_epi8( hB, tB, maskB );
+    }
+
+    hA = _mm256_add_epi32( hA, _mm256_slli_epi32( hA, 3 ) );
+    hB = _mm256_add_epi32( hB, _mm256_slli_epi32( hB, 3 ) );
+    hA = _mm256_xor_si256( hA, _mm256_srli_epi32( hA, 11 ) );
+    hB = _mm256_xor_si256( hB, _mm256_srli_epi32( hB, 11 ) );
+    hA = _mm256_add_epi32( hA, _mm256_slli_epi32( hA, 15 ) );
+    hB = _mm256_add_epi32( hB, _mm256_slli_epi32( hB, 15 ) );
+    _mm256_storeu_si256( (__m256i *) out, hA );
+    _mm256_storeu_si256( (__m256i *) ( out + 8 ), hB );
+}
+
+#endif
+
+void textHashBatch( VType *const *texts, int count, unsigned int *hashes )
+{
+    int lanes = 1;
+#if defined( __x86_64__ ) || defined( __i386__ )
+    lanes = __builtin_cpu_supports( "avx2" ) ? AVX2_LANES : SSE2_LANES;
+#endif
+
+    for ( int i = 0; i < count; i += lanes ) {
+        //the vector kernels only do Jenkins over plain strings, so check
+        //every text uses it and has no escapes
+        bool vector = lanes > 1;
+        int n = count - i < lanes ? count - i : lanes;
+        for ( int k = 0; k < n; k++ )
+            if ( texts[ i + k ]->hash != hash || ( (Text const *) texts[ i + k ] )->escaped )
+                vector = false;
+
+        if ( !vector ) {
+            for ( int k = 0; k < n; k++ )
+                hashes[ i + k ] = texts[ i + k ]->hash( texts[ i + k ] );
+            continue;
+        }
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+        //a short last batch is padded out with empty strings
+        char const *str[ MAX_LANES ];
+        int len[ MAX_LANES ];
+        int maxLen = 0;
+        unsigned int out[ MAX_LANES ];
+        for ( int k = 0; k < lanes; k++ ) {
+            str[ k ] = k < n ? ( (Text const *) texts[ i + k ] )->str : "";
+            len[ k ] = strlen( str[ k ] );
+            if ( len[ k ] > maxLen )
+                maxLen = len[ k ];
+        }
+
+        if ( lanes == AVX2_LANES )
+            jenkinsAVX2( str, len, maxLen, out );
+        else
+            jenkinsSSE2( str, len, maxLen, out );
+
+        memcpy( hashes + i, out, n * sizeof( unsigned int ) );
+#endif
+    }
+}
+
+/**
+ * Get the number of bytes an entry takes, keeping every entry aligned for
+ * its header.
+ * @param len Length of the string the entry holds.
+ * @return size_t size of the entry, a multiple of the size of a pointer.
+ */
+static size_t poolEntrySize( int len )
+{
+    size_t size = sizeof( PoolEntry ) + len + 1;
+    return ( size + sizeof( void * ) - 1 ) & ~( sizeof( void * ) - 1 );
+}
+
+/**
+ * Find the slot for a string in a pool's hash set.
+ * @param pool Pool to search.
+ * @param str String to look for.
+ * @param len Length of the string.
+ * @param h Hash of the string.
+ * @return PoolEntry** the slot holding the string, or the empty slot
+ * where it belongs.
+ */
+static PoolEntry **poolSlot( TextPool *pool, char const *str, int len, unsigned int h )
+{
+    unsigned int mask = pool->cap - 1;
+    unsigned int i = h & mask;
+    while ( pool->slots[ i ] &&
+            ( pool->slots[ i ]->hash != h || pool->slots[ i ]->len != len ||
+              memcmp( pool->slots[ i ]->str, str, len ) != 0 ) )
+        i = ( i + 1 ) & mask;
+    return &pool->slots[ i ];
+}
+
+/**
+ * Move the entries of a pool's hash set to a new set of a different size.
+ * @param pool Pool to resize.
+ * @param cap New number of slots, a power of two larger than the count.
+ */
+static void poolResize( TextPool *pool, unsigned int cap )
+{
+    PoolEntry **old = pool->slots;
+    unsigned int oldCap = pool->cap;
+
+    pool->cap = cap;
+    pool->slots = (PoolEntry **) calloc( pool->cap, sizeof( PoolEntry * ) );
+    pool->bytes = pool->bytes - oldCap * sizeof( PoolEntry * ) + cap * sizeof( PoolEntry * );
+    for ( unsigned int i = 0; i < oldCap; i++ )
+        if ( old[ i ] )
+            *poolSlot( pool, old[ i ]->str, old[ i ]->len, old[ i ]->hash ) = old[ i ];
+    free( old );
+}
+
+/**
+ * Get space for a new entry, reusing a released entry of the same size if
+ * there is one, and carving it out of the pool's arena if not.
+ * @param pool Pool to allocate from.
+ * @param len Length of the string the entry will hold.
+ * @return PoolEntry* the new entry.
+ */
+static PoolEntry *poolAlloc( TextPool *pool, int len )
+{
+    size_t size = poolEntrySize( len );
+
+    //entries too big for a block are allocated on their own
+    if ( size > POOL_CHUNK_SIZE ) {
+        pool->bytes += size;
+        return (PoolEntry *) malloc( size );
+    }
+
+    size_t class = size / sizeof( void * );
+    if ( pool->free[ class ] ) {
+        PoolFree *f = pool->free[ class ];
+        pool->free[ class ] = f->next;
+        return (PoolEntry *) f;
+    }
+
+    //start a new block when this one is full
+    PoolChunk *c = pool->chunks;
+    if ( !c || c->cap - c->used < size ) {
+        c = (PoolChunk *) malloc( sizeof( PoolChunk ) + POOL_CHUNK_SIZE );
+        c->used = 0;
+        c->cap = POOL_CHUNK_SIZE;
+        c->next = pool->chunks;
+        pool->chunks = c;
+        pool->bytes += sizeof( PoolChunk ) + POOL_CHUNK_SIZE;
+    }
+
+    PoolEntry *e = (PoolEntry *) ( c->data + c->used );
+    c->used += size;
+    return e;
+}
+
+/**
+ * Drop one reference to a string interned in a pool, and take it out of
+ * the pool's set if that was the last one.  Its space goes on the free
+ * list for its size, and the set shrinks when it gets mostly empty.
+ * @param pool Pool the string is interned in.
+ * @param str The interned string.
+ */
+static void poolRelease( TextPool *pool, char *str )
+{
+    PoolEntry *e = (PoolEntry *) ( str - offsetof( PoolEntry, str ) );
+    if ( --e->refs > 0 )
+        return;
+
+    //find the entry's slot, then shift later entries in its run back
+    //over the gap, as long as that doesn't move them before their home
+    unsigned int mask = pool->cap - 1;
+    unsigned int i = e->hash & mask;
+    while ( pool->slots[ i ] != e )
+        i = ( i + 1 ) & mask;
+    for ( unsigned int j = ( i + 1 ) & mask; pool->slots[ j ]; j = ( j + 1 ) & mask ) {
+        unsigned int home = pool->slots[ j ]->hash & mask;
+        if ( ( ( j - home ) & mask ) >= ( ( j - i ) & mask ) ) {
+            pool->slots[ i ] = pool->slots[ j ];
+            i = j;
+        }
+    }
+    pool->slots[ i ] = NULL;
+    pool->count--;
+
+    //give the entry's space back, to malloc if it has its own allocation
+    size_t size = poolEntrySize( e->len );
+    if ( size > POOL_CHUNK_SIZE ) {
+        pool->bytes -= size;
+        free( e );
+    } else {
+        PoolFree *f = (PoolFree *) e;
+        f->next = pool->free[ size / sizeof( void * ) ];
+        pool->free[ size / sizeof( void * ) ] = f;
+    }
+
+    //halve the set once it's less than an eighth full
+    if ( pool->cap > POOL_INITIAL_SLOTS && pool->count * 8 < pool->cap )
+        poolResize( pool, pool->cap / 2 );
+
+    //once nothing uses the pool, keep one block and start it over
+    if ( pool->count == 0 && pool->chunks ) {
+        while ( pool->chunks->next ) {
+            PoolChunk *old = pool->chunks->next;
+            pool->chunks->next = old->next;
+            free( old );
+            pool->bytes -= sizeof( PoolChunk ) + POOL_CHUNK_SIZE;
+        }
+        pool->chunks->used = 0;
+        memset( pool->free, 0, sizeof( pool->free ) );
+    }
+}
+
 // destroy method for Text.
 static void destroy( VType *v )
 {
     //Convert the VType pointer specifically to Text
     Text const *this = (Text const *) v;
 
-    //free its memory allocated string
-    free( this->str );
+    //free its memory allocated string, or let go of its pooled one
+    if ( this->pool )
+        poolRelease( this->pool, this->str );
+    else
+        free( this->str );
     
     free( v );
 }
 
-VType *parseText( char const *init, int *n )
+/**
+ * Find the first occurrence of either of two characters before a limit.
+ * With SSE2 this checks sixteen bytes at a time, with unaligned loads
+ * that stay inside the range, and finishes the last few bytes one at a
+ * time.
+ * @param p Start of the range to search.
+ * @param limit End of the range.
+ * @param a First character to look for.
+ * @param b Second character to look for.
+ * @return char const* pointer to the first a or b, or limit if neither
+ * is in the range.
+ */
+static char const *scanFor( char const *p, char const *limit, char a, char b )
 {
-    //get the length of the initialization string
-    int len = strlen( init );
-
-    //find the indices of the two quotation marks
-    int firstQuoteIndex = -1;
-    int secondQuoteIndex = -1;
-    for( int i = 0; i < len; i++ ) {
-        if ( init[ i ] == '"' ) {
-            if ( firstQuoteIndex < 0 )
-                firstQuoteIndex = i;
-            else if( init[ i - 1 ] != '\\' ){
-                secondQuoteIndex = i;
-                break;
-            }
-        }
+#ifdef __SSE2__
+    __m128i va = _mm_set1_epi8( a );
+    __m128i vb = _mm_set1_epi8( b );
+    for ( ; limit - p >= 16; p += 16 ) {
+        __m128i v = _mm_loadu_si128( (__m128i const *) p );
+        unsigned int mask = _mm_movemask_epi8(
+            _mm_or_si128( _mm_cmpeq_epi8( v, va ), _mm_cmpeq_epi8( v, vb ) ) );
+        if ( mask )
+            return p + __builtin_ctz( mask );
     }
+#endif
+    while ( p < limit && *p != a && *p != b )
+        p++;
+    return p;
+}
 
-    //if both quotations weren't found, init is invalid
-    if( firstQuoteIndex < 0 || secondQuoteIndex < 0 )
+VType *parseText( char const *init, int *n )
+{
+    //skip leading whitespace, the string has to start right after it
+    char const *start = init;
+    while ( isspace( (unsigned char) *start ) )
+        start++;
+    if ( *start != '"' )
         return NULL;
+    start++;
 
-    //make sure that all text before before the first quote is whitespace
-    for( int i = 0; i < firstQuoteIndex; i++ ) 
-        if( !isspace( init[ i ] ) )
+    //find the closing quote, the first one without a backslash before it
+    char const *limit = start + strlen( start );
+    char const *end = start;
+    for ( ;; ) {
+        end = scanFor( end, limit, '"', '"' );
+        if ( end == limit )
             return NULL;
+        if ( end[ -1 ] != '\\' )
+            break;
+        end++;
+    }
 
-    int newStrLen = secondQuoteIndex - firstQuoteIndex - 1;
-
-    //Allocate a Text and allocate its string field to 
-    //exactly fit all the characters and a null terminator without the quotes
-    Text *this = (Text *) malloc( sizeof( Text ) );
-    this->str = (char *) malloc( ( newStrLen + 1 ) * sizeof( char ) );
-
-    //copy the characters from the init string, 
-    //skipping the quotes and checking for invalid chars
-    int wordLen = 0;
-    for( int i = 0; i < newStrLen; i++ ) {
-
-        //properly offset the init index accounting for all quotes
-        int initIndex = firstQuoteIndex + 1 + i;
-
-        //check for excape sequences
-        if( init[ initIndex ] == '\\' ) {
-
-            switch( init[ initIndex + 1 ] ) {
-            case 'n':
-                this->str[ wordLen++ ] = '\n';
-                i++;
-                break;
-            case 't':
-                this->str[ wordLen++ ] = '\t';
-                i++;
-                break;
-            case '\\':
-                this->str[ wordLen++ ] = '\\';
-                i++;
-                break;
-            case '"':
-                if ( initIndex + 1 == secondQuoteIndex )
-                    return NULL;
-                this->str[ wordLen++ ] = '"';
-                i++;
-                break;
-            }
-            
-        } else {
-
-            //check for invalid linefeed
-            if( init[ initIndex ] == '\n' )
-                return NULL;
-
-            //copy this valid character into the new Text struct
-            this->str[ wordLen++ ] = init[ initIndex ];
-
-        }
+    //check for an invalid linefeed, noting whether there are any escapes
+    //on the way
+    bool escaped = false;
+    for ( char const *pos = start; ( pos = scanFor( pos, end, '\\', '\n' ) ) < end; pos++ ) {
+        if ( *pos == '\n' )
+            return NULL;
+        escaped = true;
     }
 
-    //add a null terminator to the Text string
-    this->str[ wordLen ] = '\0';
+    //Allocate a Text and copy the characters between the quotes as they
+    //are, leaving any escapes to be decoded when they're needed
+    Text *this = (Text *) malloc( sizeof( Text ) );
+    this->str = (char *) malloc( ( end - start + 1 ) * sizeof( char ) );
+    memcpy( this->str, start, end - start );
+    this->str[ end - start ] = '\0';
+    this->escaped = escaped;
 
     //fill the rest of the Text fields
     this->print = print;
     this->equals = equals;
-    this->hash = hash;
+    this->hash = selectedHash;
     this->destroy = destroy;
+    this->pool = NULL;
 
     // Fill in the length pointer if the caller asked for it
     if( n )
-        *n = secondQuoteIndex + 1;
+        *n = end + 1 - init;
+
+    //return the Text as a pointer to its superclass
+    return (VType *) this;
+}
+
+void initText( Text *this, char const *str )
+{
+    this->print = print;
+    this->equals = equals;
+    this->hash = selectedHash;
+    this->destroy = destroy;
+    this->str = (char *) str;
+    this->escaped = false;
+    this->pool = NULL;
+}
+
+VType *makeText( char const *str )
+{
+    //Allocate a Text with its own copy of the string
+    Text *this = (Text *) malloc( sizeof( Text ) );
+    char *copy = (char *) malloc( strlen( str ) + 1 );
+    strcpy( copy, str );
+    initText( this, copy );
 
     //return the Text as a pointer to its superclass
     return (VType *) this;
-}
\ No newline at end of file
+}
+
+bool isText( VType const *v )
+{
+    // Texts are the only values that use this print function.
+    return v->print == print;
+}
+
+TextPool *makeTextPool( void )
+{
+    TextPool *pool = (TextPool *) malloc( sizeof( TextPool ) );
+    pool->chunks = NULL;
+    pool->cap = POOL_INITIAL_SLOTS;
+    pool->count = 0;
+    pool->slots = (PoolEntry **) calloc( pool->cap, sizeof( PoolEntry * ) );
+    pool->bytes = sizeof( TextPool ) + pool->cap * sizeof( PoolEntry * );
+    memset( pool->free, 0, sizeof( pool->free ) );
+    return pool;
+}
+
+void textIntern( TextPool *pool, VType *v )
+{
+    if ( !isText( v ) )
+        return;
+    Text *this = (Text *) v;
+    if ( this->pool )
+        return;
+
+    //the Text is about to change anyway, so its escapes are decoded in
+    //place, rather than into a copy
+    if ( this->escaped ) {
+        decode( this->str, this->str );
+        this->escaped = false;
+    }
+
+    //the pool always uses the same hash, whichever one the Text uses
+    int len = strlen( this->str );
+    unsigned int h = wideHashBytes( this->str, len );
+
+    //keep the set no more than three quarters full
+    if ( ( pool->count + 1 ) * 4 > pool->cap * 3 )
+        poolResize( pool, pool->cap * 2 );
+
+    //add the string if it isn't there yet
+    PoolEntry **slot = poolSlot( pool, this->str, len, h );
+    if ( !*slot ) {
+        PoolEntry *e = poolAlloc( pool, len );
+        e->refs = 0;
+        e->hash = h;
+        e->len = len;
+        memcpy( e->str, this->str, len + 1 );
+        *slot = e;
+        pool->count++;
+    }
+
+    //switch the Text over to the shared copy
+    ( *slot )->refs++;
+    free( this->str );
+    this->str = ( *slot )->str;
+    this->pool = pool;
+}
+
+int textPoolSize( TextPool *pool )
+{
+    return pool->count;
+}
+
+size_t textPoolBytes( TextPool *pool )
+{
+    return pool->bytes;
+}
+
+void freeTextPool( TextPool *pool )
+{
+    while ( pool->chunks ) {
+        PoolChunk *next = pool->chunks->next;
+        free( pool->chunks );
+        pool->chunks = next;
+    }
+    free( pool->slots );
+    free( pool );
+}
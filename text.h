@@ -4,7 +4,14 @@
     Header for the Text subclass of VType
 */
 
+#ifndef TEXT_H
+#define TEXT_H
+
 #include "vtype.h"
+#include <stddef.h>
+
+/** Incomplete type for a pool of interned strings shared by Texts. */
+typedef struct TextPoolStruct TextPool;
 
 /** Subclass of VType for storing integers. */
 typedef struct {
@@ -21,10 +28,50 @@ typedef struct {
   /** Inherited from VType */
   void (*destroy)( struct VTypeStruct *v );
 
-  /** string stored by this text. */
+  /** string stored by this text.  Use textString to read it, since it
+      may still hold escape sequences. */
   char *str;
+
+  /** True if str still holds the escape sequences it was parsed with.
+      Reading a Text never changes it: textString decodes into a copy,
+      and only interning decodes str itself. */
+  bool escaped;
+
+  /** Pool the string is interned in, or null if the Text has its own copy. */
+  TextPool *pool;
 } Text;
 
+/** Hash functions a Text can use. */
+typedef enum {
+  /** Jenkins one-at-a-time hash, the default. */
+  TEXT_HASH_JENKINS,
+
+  /** Word-at-a-time multiply-mix hash, faster on longer strings. */
+  TEXT_HASH_WIDE
+} TextHash;
+
+/**
+ * Choose the hash function for Text objects parsed from now on.  Texts
+ * hashed with different functions never hash alike, so choose before
+ * putting any Text keys in a map.
+ * @param which Hash function to use.
+ */
+void textSelectHash( TextHash which );
+
+/**
+ * Hash a batch of Text objects, giving the same results as calling each
+ * one's hash method.  Jenkins hashes are computed sixteen or eight
+ * strings at a time with AVX2 or SSE2, when the processor has them.
+ * Only the mixing is vectorized: each string's bytes are gathered into
+ * the lanes one at a time.  That's still about twice as fast as calling
+ * the hash method on short keys, and a third faster on 30 to 60 byte
+ * ones.
+ * @param texts Text objects to hash.
+ * @param count Number of objects in texts.
+ * @param hashes Filled in with the hash of each object.
+ */
+void textHashBatch( VType *const *texts, int count, unsigned int *hashes );
+
 /**
  * Make an instance of Text holding the text parsed from the init string.
  * @param init String countaining the initialization value as text.
@@ -32,3 +79,81 @@ typedef struct {
  * @return VType* pointer to the new VType instance
  */
 VType *parseText( char const *init, int *n );
+
+/**
+ * Make an instance of Text holding a copy of the given string.
+ * @param str String for the Text to hold.
+ * @return VType* pointer to the new VType instance
+ */
+VType *makeText( char const *str );
+
+/**
+ * Fill in a Text that lives in caller-provided storage and refers to a
+ * string it doesn't own, such as one in a read-only image.  It must not
+ * be destroyed, and the string must outlive it.
+ * @param this Text to initialize.
+ * @param str String for the Text to refer to.
+ */
+void initText( Text *this, char const *str );
+
+/**
+ * Get the string a Text holds, with any escape sequences it was parsed
+ * with decoded.  The Text isn't changed, so several threads can read one
+ * Text at once.  If it still holds escapes, the decoded string is a new
+ * copy for the caller to free.
+ * @param v Text to get the string of.
+ * @param copy Set to the decoded copy, or to null if the Text's own
+ * string was returned; either way, free( *copy ) is safe.
+ * @return char const* the decoded string, good until *copy is freed or
+ * the Text is destroyed.
+ */
+char const *textString( VType const *v, char **copy );
+
+/**
+ * Report whether the given value is an instance of Text.
+ * @param v Pointer to the value to check.
+ * @return bool true if v is a Text.
+ */
+bool isText( VType const *v );
+
+/**
+ * Make an empty pool for interning Text strings.  Equal strings interned
+ * in the same pool are stored once, and Texts sharing a pool compare
+ * equal by comparing string pointers.
+ * @return TextPool* pointer to the new pool.
+ */
+TextPool *makeTextPool( void );
+
+/**
+ * Move the string of a Text into the pool, sharing it with any equal
+ * string already there.  The Text releases its reference when it's
+ * destroyed.  Values that aren't Texts, and Texts that are already
+ * interned, are left alone.
+ * @param pool Pool to intern the string in.
+ * @param v Value to intern.
+ */
+void textIntern( TextPool *pool, VType *v );
+
+/**
+ * Get the number of different strings in a pool.
+ * @param pool Pointer to the pool.
+ * @return int number of strings with at least one Text using them.
+ */
+int textPoolSize( TextPool *pool );
+
+/**
+ * Get the amount of memory a pool is holding, for its strings, including
+ * released ones waiting to be reused, and for its hash set.
+ * @param pool Pointer to the pool.
+ * @return size_t number of bytes the pool has allocated.
+ */
+size_t textPoolBytes( TextPool *pool );
+
+/**
+ * Free all the memory used by a pool.  Every Text interned in it must
+ * have been destroyed first.
+ * @param pool Pool to free.
+ */
+void freeTextPool( TextPool *pool );
+
+#endif
@@ -0,0 +1,129 @@
+// Benchmark for the Text hash functions, on keys from a driver input file.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "vtype.h"
+#include "text.h"
+#include "input.h"
+
+/** Number of times to hash every key for each measurement. */
+#define ROUNDS 200
+
+/**
+ * Parse every quoted string in the given file as a Text.
+ * @param fp File to read.
+ * @param count Filled in with the number of Texts parsed.
+ * @return VType** array of the Texts.
+ */
+static VType **readTexts( FILE *fp, int *count )
+{
+  int cap = 1024;
+  VType **texts = (VType **) malloc( cap * sizeof( VType * ) );
+  *count = 0;
+
+  char *line;
+  while ( ( line = readLine( fp ) ) ) {
+    // Each quote that starts a string is followed by the rest of it.
+    char *pos = line;
+    while ( ( pos = strchr( pos, '"' ) ) ) {
+      int n;
+      VType *t = parseText( pos, &n );
+      if ( !t )
+        break;
+      if ( *count == cap ) {
+        cap *= 2;
+        texts = (VType **) realloc( texts, cap * sizeof( VType * ) );
+      }
+      texts[ ( *count )++ ] = t;
+      pos += n;
+    }
+    free( line );
+  }
+
+  return texts;
+}
+
+/**
+ * Report the time per key for some number of hashes.
+ * @param name Name of the measurement.
+ * @param start Clock reading when the measurement started.
+ * @param hashes Number of hashes computed.
+ * @param check Sum of the hashes, so the work can't be optimized away.
+ */
+static void report( char const *name, clock_t start, long hashes, unsigned int check )
+{
+  double secs = (double) ( clock() - start ) / CLOCKS_PER_SEC;
+  printf( "%-16s %8.2f ns/key  (check %08x)\n", name, secs * 1e9 / hashes, check );
+}
+
+/**
+ * Time hashing the Texts one at a time with their own hash method.
+ * @param name Name of the measurement.
+ * @param texts Texts to hash.
+ * @param count Number of Texts.
+ */
+static void timeScalar( char const *name, VType **texts, int count )
+{
+  unsigned int check = 0;
+  clock_t start = clock();
+  for ( int r = 0; r < ROUNDS; r++ )
+    for ( int i = 0; i < count; i++ )
+      check += texts[ i ]->hash( texts[ i ] );
+  report( name, start, (long) ROUNDS * count, check );
+}
+
+/**
+ * Time hashing the Texts with the batch kernel.
+ * @param name Name of the measurement.
+ * @param texts Texts to hash.
+ * @param count Number of Texts.
+ */
+static void timeBatch( char const *name, VType **texts, int count )
+{
+  unsigned int *hashes = (unsigned int *) malloc( count * sizeof( unsigned int ) );
+  unsigned int check = 0;
+  clock_t start = clock();
+  for ( int r = 0; r < ROUNDS; r++ ) {
+    textHashBatch( texts, count, hashes );
+    for ( int i = 0; i < count; i++ )
+      check += hashes[ i ];
+  }
+  report( name, start, (long) ROUNDS * count, check );
+  free( hashes );
+}
+
+int main( int argc, char *argv[] )
+{
+  char const *path = argc > 1 ? argv[ 1 ] : "input-10.txt";
+  FILE *fp = fopen( path, "r" );
+  if ( !fp ) {
+    perror( path );
+    return EXIT_FAILURE;
+  }
+
+  // Parse the same keys once for each hash function.
+  int count;
+  VType **jenkins = readTexts( fp, &count );
+  rewind( fp );
+  textSelectHash( TEXT_HASH_WIDE );
+  VType **wide = readTexts( fp, &count );
+  fclose( fp );
+
+  printf( "%d keys from %s\n", count, path );
+  timeScalar( "jenkins", jenkins, count );
+  timeBatch( "jenkins batch", jenkins, count );
+  timeScalar( "wide", wide, count );
+  timeBatch( "wide batch", wide, count );
+
+  for ( int i = 0; i < count; i++ ) {
+    jenkins[ i ]->destroy( jenkins[ i ] );
+    wide[ i ]->destroy( wide[ i ] );
+  }
+  free( jenkins );
+  free( wide );
+
+  return EXIT_SUCCESS;
+}
@@ -45,6 +45,32 @@ int main()
   VType *t6 = parseText( "\"The quick brown fox jumps over the lazy dog\"", &n );
   assert( n == 45 );
 
+  // Escapes are decoded, including in strings longer than one SSE2 block.
+  VType *t7 = parseText( "  \"a \\\"string\\\" that runs well past sixteen bytes\\n\\tand \\\\/\" x",
+                         &n );
+  assert( n == 61 );
+
+  // They're compared and hashed as decoded, and reading the decoded
+  // string leaves the Text as it was.
+  VType *plain = makeText( "a \"string\" that runs well past sixteen bytes\n\tand \\/" );
+  assert( t7->equals( t7, plain ) && plain->equals( plain, t7 ) );
+  assert( t7->hash( t7 ) == plain->hash( plain ) );
+  char *copy7, *copyPlain;
+  assert( strcmp( textString( t7, &copy7 ), textString( plain, &copyPlain ) ) == 0 );
+  assert( copy7 && !copyPlain && ( (Text *) t7 )->escaped );
+  free( copy7 );
+  assert( t7->equals( t7, plain ) && t7->hash( t7 ) == plain->hash( plain ) );
+  VType *t8 = parseText( "\"a \\\"string\\\"\"", NULL );
+  assert( !t8->equals( t8, plain ) && !plain->equals( plain, t8 ) );
+  t8->destroy( t8 );
+  plain->destroy( plain );
+  t7->destroy( t7 );
+
+  // Missing quotes, text before the quote and raw linefeeds are invalid.
+  assert( parseText( "\"abc", &n ) == NULL );
+  assert( parseText( "x \"abc\"", &n ) == NULL );
+  assert( parseText( "\"ab\nc\"", &n ) == NULL );
+
   // Check the hash values for these objects.
   assert( t1->hash( t1 ) == 0xED131F5B );
   assert( t2->hash( t2 ) == 0xED131F5B );
@@ -56,6 +82,94 @@ int main()
   assert( t6->hash( t6 ) == 0x519E91F5 );
 
   
+  // The batch hash should match the hash method for every object,
+  // including a partial last batch.
+  VType *all[ 6 ] = { t1, t2, t3, t4, t5, t6 };
+  unsigned int hashes[ 6 ];
+  textHashBatch( all, 6, hashes );
+  for ( int i = 0; i < 6; i++ )
+    assert( hashes[ i ] == all[ i ]->hash( all[ i ] ) );
+
+  // Try a bigger batch with a mix of lengths and non-ASCII bytes.
+  VType *batch[ 40 ];
+  for ( int i = 0; i < 40; i++ ) {
+    char buf[ 64 ];
+    sprintf( buf, "\"%.*s\xE9\"", i, "0123456789abcdefghijklmnopqrstuvwxyzABCD" );
+    batch[ i ] = parseText( buf, NULL );
+  }
+  unsigned int batchHashes[ 40 ];
+  textHashBatch( batch, 40, batchHashes );
+  for ( int i = 0; i < 40; i++ ) {
+    assert( batchHashes[ i ] == batch[ i ]->hash( batch[ i ] ) );
+    batch[ i ]->destroy( batch[ i ] );
+  }
+
+  // Texts parsed after selecting the wide hash should use it.
+  textSelectHash( TEXT_HASH_WIDE );
+  VType *w1 = parseText( "\"abc\"", NULL );
+  VType *w2 = parseText( " \"abc\" ", NULL );
+  VType *w6 = parseText( "\"The quick brown fox jumps over the lazy dog\"", NULL );
+  assert( w1->hash( w1 ) == w2->hash( w2 ) );
+  assert( w1->hash( w1 ) != t1->hash( t1 ) );
+  assert( w1->equals( w1, t1 ) );
+  VType *wide[ 3 ] = { w1, w2, w6 };
+  textHashBatch( wide, 3, hashes );
+  for ( int i = 0; i < 3; i++ )
+    assert( hashes[ i ] == wide[ i ]->hash( wide[ i ] ) );
+  w1->destroy( w1 );
+  w2->destroy( w2 );
+  w6->destroy( w6 );
+  textSelectHash( TEXT_HASH_JENKINS );
+
+  // Equal strings interned in a pool share one copy until the last
+  // Text using it is destroyed.
+  TextPool *pool = makeTextPool();
+  VType *p1 = parseText( "\"active\"", NULL );
+  VType *p2 = parseText( "\"active\"", NULL );
+  VType *p3 = parseText( "\"idle\"", NULL );
+  textIntern( pool, p1 );
+  textIntern( pool, p2 );
+  textIntern( pool, p3 );
+  textIntern( pool, p3 );
+  assert( textPoolSize( pool ) == 2 );
+  assert( ( (Text *) p1 )->str == ( (Text *) p2 )->str );
+  assert( p1->equals( p1, p2 ) && !p1->equals( p1, p3 ) );
+  assert( p1->equals( p1, t1 ) == false && p1->hash( p1 ) == p2->hash( p2 ) );
+  p1->destroy( p1 );
+  assert( textPoolSize( pool ) == 2 && strcmp( ( (Text *) p2 )->str, "active" ) == 0 );
+  p2->destroy( p2 );
+  assert( textPoolSize( pool ) == 1 );
+  for ( int i = 0; i < 200; i++ ) {
+    char buf[ 32 ];
+    sprintf( buf, "\"s%d\"", i );
+    batch[ i % 40 ] = parseText( buf, NULL );
+    textIntern( pool, batch[ i % 40 ] );
+    if ( i % 40 == 39 )
+      for ( int j = 0; j < 40; j++ )
+        batch[ j ]->destroy( batch[ j ] );
+  }
+  assert( textPoolSize( pool ) == 1 && p3->equals( p3, p3 ) );
+
+  // Interning and releasing distinct strings of many lengths reuses the
+  // released space, so the pool stops growing once it has enough.
+  size_t settled = 0;
+  for ( int i = 0; i < 100000; i++ ) {
+    char buf[ 64 ];
+    sprintf( buf, "\"%.*s%d\"", i % 37, "abcdefghijklmnopqrstuvwxyzabcdefghijk", i );
+    if ( i >= 40 )
+      batch[ i % 40 ]->destroy( batch[ i % 40 ] );
+    batch[ i % 40 ] = parseText( buf, NULL );
+    textIntern( pool, batch[ i % 40 ] );
+    if ( i == 2000 )
+      settled = textPoolBytes( pool );
+  }
+  assert( textPoolSize( pool ) == 41 && textPoolBytes( pool ) == settled );
+  for ( int j = 0; j < 40; j++ )
+    batch[ j ]->destroy( batch[ j ] );
+  p3->destroy( p3 );
+  assert( textPoolSize( pool ) == 0 );
+  freeTextPool( pool );
+
   // Get all the Text objects to print themselves (we can't test this
   // with assert)
   t1->print( t1 );
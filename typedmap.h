@@ -0,0 +1,195 @@
+/**
+    @file typedmap.h
+    @author
+    Generator for hash maps specialized to one key type and one value
+    type.  The generic Map in map.h calls through the VType function
+    pointers for every hash and comparison; a generated map stores its
+    keys and values inline in its nodes and calls the hash and equality
+    functions directly, so the compiler can inline them.  Use the generic
+    map for heterogeneous data.
+
+    MAP_DEFINE( IntIntMap, int, int, hashInt, equalsInt ) defines the type
+    IntIntMap and these functions, mirroring the ones in map.h:
+
+      IntIntMap *makeIntIntMap( int len );
+      int IntIntMapSize( IntIntMap *m );
+      int IntIntMapCapacity( IntIntMap *m );
+      int *IntIntMapGet( IntIntMap *m, int key );
+      int *IntIntMapEntry( IntIntMap *m, int key, bool *inserted );
+      void IntIntMapSet( IntIntMap *m, int key, int val );
+      bool IntIntMapRemove( IntIntMap *m, int key );
+      void IntIntMapReserve( IntIntMap *m, int n );
+      void IntIntMapCompact( IntIntMap *m );
+      void freeIntIntMap( IntIntMap *m );
+
+    The hash function takes a key and returns an unsigned int, and the
+    equality function takes two keys and returns a bool.  Keys and values
+    are copied in and out by value; if they are pointers, the caller
+    still owns what they point to.
+*/
+
+#ifndef TYPEDMAP_H
+#define TYPEDMAP_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+
+/** The table shrinks when fewer than 1 / TYPEDMAP_SHRINK_LOAD of its
+    elements are in use, the same policy as the generic map. */
+#define TYPEDMAP_SHRINK_LOAD 4
+
+/** Define a hash map type, Name, from K keys to V values, along with
+    all of its functions.  The functions are static inline, so this can
+    be used in a header or a source file.
+    @param Name Name of the map type to define.
+    @param K Type of the keys.
+    @param V Type of the values.
+    @param hashFn Function to compute the hash of a key.
+    @param eqFn Function to compare two keys for equality.
+*/
+#define MAP_DEFINE( Name, K, V, hashFn, eqFn )                               \
+                                                                             \
+  /** Node containing a key / value pair, stored inline. */                 \
+  typedef struct Name##NodeStruct {                                          \
+    K key;                                                                   \
+    V val;                                                                   \
+    unsigned int hash;                                                       \
+    struct Name##NodeStruct *next;                                           \
+  } Name##Node;                                                              \
+                                                                             \
+  /** Hash table of key / value pairs. */                                   \
+  typedef struct {                                                           \
+    Name##Node **table;                                                      \
+    int tlen;                                                                \
+    int minLen;                                                              \
+    int size;                                                                \
+  } Name;                                                                    \
+                                                                             \
+  static inline Name *make##Name( int len )                                  \
+  {                                                                          \
+    Name *m = (Name *) malloc( sizeof( Name ) );                             \
+    m->size = 0;                                                             \
+    m->tlen = len > 0 ? len : 1;                                             \
+    m->minLen = m->tlen;                                                     \
+    m->table = (Name##Node **) calloc( m->tlen, sizeof( Name##Node * ) );    \
+    return m;                                                                \
+  }                                                                          \
+                                                                             \
+  static inline int Name##Size( Name *m )                                    \
+  {                                                                          \
+    return m->size;                                                          \
+  }                                                                          \
+                                                                             \
+  static inline int Name##Capacity( Name *m )                                \
+  {                                                                          \
+    return m->tlen;                                                          \
+  }                                                                          \
+                                                                             \
+  /* Relink every node into a new table of the given length. */             \
+  static inline void Name##Resize( Name *m, int newTLen )                    \
+  {                                                                          \
+    Name##Node **newTable =                                                  \
+      (Name##Node **) calloc( newTLen, sizeof( Name##Node * ) );             \
+    for ( int i = 0; i < m->tlen; i++ ) {                                    \
+      Name##Node *current = m->table[ i ];                                   \
+      while ( current ) {                                                    \
+        Name##Node *nextNode = current->next;                                \
+        int newKeyIndex = current->hash % newTLen;                           \
+        current->next = newTable[ newKeyIndex ];                             \
+        newTable[ newKeyIndex ] = current;                                   \
+        current = nextNode;                                                  \
+      }                                                                      \
+    }                                                                        \
+    free( m->table );                                                        \
+    m->table = newTable;                                                     \
+    m->tlen = newTLen;                                                       \
+  }                                                                          \
+                                                                             \
+  /* Find the link to the node with the given key, or to the null */        \
+  /* link at the end of its list. */                                        \
+  static inline Name##Node **Name##FindLink( Name *m, K key, unsigned int h ) \
+  {                                                                          \
+    Name##Node **link = &m->table[ h % m->tlen ];                            \
+    while ( *link && ( (*link)->hash != h || !eqFn( key, (*link)->key ) ) )  \
+      link = &(*link)->next;                                                 \
+    return link;                                                             \
+  }                                                                          \
+                                                                             \
+  static inline V *Name##Get( Name *m, K key )                               \
+  {                                                                          \
+    Name##Node *keyNode = *Name##FindLink( m, key, hashFn( key ) );          \
+    return keyNode ? &keyNode->val : NULL;                                   \
+  }                                                                          \
+                                                                             \
+  static inline V *Name##Entry( Name *m, K key, bool *inserted )             \
+  {                                                                          \
+    unsigned int h = hashFn( key );                                          \
+    Name##Node **link = Name##FindLink( m, key, h );                         \
+    if ( *link ) {                                                           \
+      *inserted = false;                                                     \
+      return &(*link)->val;                                                  \
+    }                                                                        \
+    if ( m->size == m->tlen ) {                                              \
+      Name##Resize( m, m->tlen * 2 );                                        \
+      link = &m->table[ h % m->tlen ];                                       \
+    }                                                                        \
+    Name##Node *newNode = (Name##Node *) malloc( sizeof( Name##Node ) );     \
+    newNode->key = key;                                                      \
+    newNode->hash = h;                                                       \
+    newNode->next = *link;                                                   \
+    *link = newNode;                                                         \
+    m->size++;                                                               \
+    *inserted = true;                                                        \
+    return &newNode->val;                                                    \
+  }                                                                          \
+                                                                             \
+  static inline void Name##Set( Name *m, K key, V val )                      \
+  {                                                                          \
+    bool inserted;                                                           \
+    *Name##Entry( m, key, &inserted ) = val;                                 \
+  }                                                                          \
+                                                                             \
+  static inline bool Name##Remove( Name *m, K key )                          \
+  {                                                                          \
+    Name##Node **link = Name##FindLink( m, key, hashFn( key ) );             \
+    if ( !*link )                                                            \
+      return false;                                                          \
+    Name##Node *oldNode = *link;                                             \
+    *link = oldNode->next;                                                   \
+    m->size--;                                                               \
+    free( oldNode );                                                         \
+    if ( m->tlen > m->minLen && m->size < m->tlen / TYPEDMAP_SHRINK_LOAD ) { \
+      int newTLen = m->tlen / 2;                                             \
+      Name##Resize( m, newTLen > m->minLen ? newTLen : m->minLen );          \
+    }                                                                        \
+    return true;                                                             \
+  }                                                                          \
+                                                                             \
+  static inline void Name##Reserve( Name *m, int n )                         \
+  {                                                                          \
+    if ( n > m->tlen )                                                       \
+      Name##Resize( m, n );                                                  \
+  }                                                                          \
+                                                                             \
+  static inline void Name##Compact( Name *m )                                \
+  {                                                                          \
+    int newTLen = m->size > 0 ? m->size * 2 : 1;                             \
+    if ( newTLen < m->tlen )                                                 \
+      Name##Resize( m, newTLen );                                            \
+  }                                                                          \
+                                                                             \
+  static inline void free##Name( Name *m )                                   \
+  {                                                                          \
+    for ( int i = 0; i < m->tlen; i++ ) {                                    \
+      Name##Node *current = m->table[ i ];                                   \
+      while ( current ) {                                                    \
+        Name##Node *nextNode = current->next;                                \
+        free( current );                                                     \
+        current = nextNode;                                                  \
+      }                                                                      \
+    }                                                                        \
+    free( m->table );                                                        \
+    free( m );                                                               \
+  }
+
+#endif